@@ -0,0 +1,225 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+
+#include "archive.h"
+#include "console.h"
+#include "hash.h"
+
+static const char archive_magic[4] = { 'G', 'R', 'A', 'R' };
+static const unsigned archive_version = 2;
+static const unsigned long long archive_page = 4096;
+
+static const size_t trailer_size = 4 + 4 + 8 + 8 + 8 + 8;
+
+static_assert(sizeof(ArchiveIndexEntry) == 32, "ArchiveIndexEntry has padding");
+
+template<class T> static T get_le (const char *p)
+{
+    T v;
+    memcpy(&v, p, sizeof v);
+    return endian_little(v);
+}
+
+static bool is_canonical (const std::string &path)
+{
+    return path.length() > 0 && absolute_path("/", path) == path;
+}
+
+Archive::Archive (const std::string &filename)
+  : file(filename), strings(NULL)
+{
+    const char *base = file.data();
+    size_t sz = file.size();
+    if (sz < trailer_size || memcmp(base, archive_magic, 4) != 0) {
+        EXCEPT << filename << ": Not an archive" << ENDL;
+    }
+    const char *t = base + sz - trailer_size;
+    unsigned version = get_le<unsigned>(t + 4);
+    if (memcmp(t, archive_magic, 4) != 0 || version != archive_version) {
+        EXCEPT << filename << ": Unsupported or truncated archive" << ENDL;
+    }
+    unsigned long long count = get_le<unsigned long long>(t + 8);
+    unsigned long long index_offset = get_le<unsigned long long>(t + 16);
+    unsigned long long strings_offset = get_le<unsigned long long>(t + 24);
+    unsigned long long strings_size = get_le<unsigned long long>(t + 32);
+    if (strings_offset > sz || strings_size > sz - strings_offset) {
+        EXCEPT << filename << ": Corrupt archive" << ENDL;
+    }
+    // Checks the index is in range.
+    index = file.view<ArchiveIndexEntry>(index_offset, count);
+    strings = base + strings_offset;
+    for (size_t i=0 ; i<index.size() ; ++i) {
+        const ArchiveIndexEntry &e = index[i];
+        unsigned long long off = endian_little(e.offset), len = endian_little(e.size);
+        if (off > sz || len > sz - off
+            || endian_little(e.pathOffset) + (unsigned long long)endian_little(e.pathLength) > strings_size) {
+            EXCEPT << filename << ": Corrupt archive entry " << i << ENDL;
+        }
+    }
+}
+
+const ArchiveIndexEntry *Archive::find (const std::string &path) const
+{
+    unsigned long long h = hash64(path.data(), path.length());
+    size_t lo = 0, hi = index.size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (endian_little(index[mid].hash) < h) lo = mid + 1;
+        else hi = mid;
+    }
+    for ( ; lo<index.size() && endian_little(index[lo].hash) == h ; ++lo) {
+        const ArchiveIndexEntry &e = index[lo];
+        if (endian_little(e.pathLength) == path.length()
+            && memcmp(strings + endian_little(e.pathOffset), path.data(), path.length()) == 0)
+            return &e;
+    }
+    return NULL;
+}
+
+std::string Archive::getPath (size_t i) const
+{
+    const ArchiveIndexEntry &e = index[i];
+    return std::string(strings + endian_little(e.pathOffset), endian_little(e.pathLength));
+}
+
+Span<const char> Archive::get (size_t i) const
+{
+    const ArchiveIndexEntry &e = index[i];
+    return Span<const char>(file.data() + endian_little(e.offset), endian_little(e.size));
+}
+
+Span<const char> Archive::get (const std::string &path) const
+{
+    const ArchiveIndexEntry *e = find(path);
+    if (e == NULL) {
+        EXCEPT << file.filename << ": No such entry: " << path << ENDL;
+    }
+    return get(e - index.data());
+}
+
+void Archive::prefetch (const std::string &path)
+{
+    const ArchiveIndexEntry *e = find(path);
+    if (e == NULL) return;
+    file.advise(MappedFile::ADVISE_WILLNEED, endian_little(e->offset), endian_little(e->size));
+}
+
+static void pad_to_page (BufferedOutFile &out)
+{
+    static const char zeroes[archive_page] = { 0 };
+    size_t pad = (archive_page - out.tell() % archive_page) % archive_page;
+    out.write_bytes(zeroes, pad);
+}
+
+ArchiveWriter::ArchiveWriter (const std::string &filename)
+  : out(filename, ENDIAN_LITTLE), finished(false)
+{
+    out.write_bytes(archive_magic, 4);
+    out.write(archive_version);
+    pad_to_page(out);
+}
+
+ArchiveWriter::~ArchiveWriter (void)
+{
+    if (finished) return;
+    try {
+        finish();
+    } catch (const Exception &e) {
+        CERR << e << std::endl;
+    }
+}
+
+void ArchiveWriter::add (const std::string &path, const void *data, size_t sz)
+{
+    if (!is_canonical(path)) {
+        EXCEPT << out.filename << ": Not a canonical path: \"" << path << "\"" << ENDL;
+    }
+    ArchiveIndexEntry e;
+    e.hash = hash64(path.data(), path.length());
+    e.offset = out.tell();
+    e.size = sz;
+    e.pathOffset = strings.length();
+    e.pathLength = path.length();
+    index.push_back(e);
+    strings += path;
+    out.write_bytes(data, sz);
+    pad_to_page(out);
+}
+
+void ArchiveWriter::addFile (const std::string &path, const std::string &filename)
+{
+    MappedFile f(filename);
+    f.advise(MappedFile::ADVISE_SEQUENTIAL);
+    add(path, f.data(), f.size());
+}
+
+namespace {
+    struct IndexOrder {
+        const std::string &strings;
+        IndexOrder (const std::string &strings) : strings(strings) { }
+        int cmpPath (const ArchiveIndexEntry &a, const ArchiveIndexEntry &b) const
+        {
+            return strings.compare(a.pathOffset, a.pathLength, strings, b.pathOffset, b.pathLength);
+        }
+        bool operator() (const ArchiveIndexEntry &a, const ArchiveIndexEntry &b) const
+        {
+            if (a.hash != b.hash) return a.hash < b.hash;
+            return cmpPath(a, b) < 0;
+        }
+    };
+}
+
+void ArchiveWriter::finish (void)
+{
+    if (finished) return;
+    finished = true;
+
+    IndexOrder order(strings);
+    std::sort(index.begin(), index.end(), order);
+    for (size_t i=1 ; i<index.size() ; ++i) {
+        if (order.cmpPath(index[i-1], index[i]) == 0) {
+            EXCEPT << out.filename << ": Duplicate entry: "
+                   << strings.substr(index[i].pathOffset, index[i].pathLength) << ENDL;
+        }
+    }
+
+    unsigned long long index_offset = out.tell();
+    for (size_t i=0 ; i<index.size() ; ++i) {
+        const ArchiveIndexEntry &e = index[i];
+        out.write(e.hash);
+        out.write(e.offset);
+        out.write(e.size);
+        out.write(e.pathOffset);
+        out.write(e.pathLength);
+    }
+    unsigned long long strings_offset = out.tell();
+    out.write_bytes(strings.data(), strings.length());
+
+    out.write_bytes(archive_magic, 4);
+    out.write(archive_version);
+    out.write((unsigned long long)index.size());
+    out.write(index_offset);
+    out.write(strings_offset);
+    out.write((unsigned long long)strings.length());
+    out.flush();
+}
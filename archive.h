@@ -0,0 +1,114 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <string>
+#include <vector>
+
+#include "io_util.h"
+#include "span.h"
+
+/* An archive is many files packed into one, so that loading them costs one
+ * open and no per file filesystem overhead.  Layout (little endian):
+ *
+ *   header     char[4] "GRAR", u32 version, padded to a page
+ *   data       the contents of each entry, each starting on a page boundary
+ *   index      ArchiveIndexEntry[count], sorted by (hash, path)
+ *   strings    the paths, not terminated
+ *   trailer    char[4] "GRAR", u32 version, u64 count, u64 index offset,
+ *              u64 strings offset, u64 strings size
+ *
+ * The trailer is at the end so that the archive can be written in one pass.
+ * Paths are canonical, i.e. as produced by absolute_path, e.g. "/common/a.dds".
+ */
+
+/** An entry of the archive's index, as it is on disk. */
+struct ArchiveIndexEntry {
+    unsigned long long hash;
+    unsigned long long offset;
+    unsigned long long size;
+    unsigned pathOffset;
+    unsigned pathLength;
+};
+
+/** Reads an archive through a memory mapping, so entries are returned in
+ * place without copying.  Lookups are a binary search of the index. */
+class Archive {
+    MappedFile file;
+    Span<const ArchiveIndexEntry> index;
+    const char *strings;
+
+    const ArchiveIndexEntry *find (const std::string &path) const;
+
+    public:
+
+    /** Throws an Exception if the file is not a valid archive. */
+    Archive (const std::string &filename);
+
+    const std::string &getFilename (void) const { return file.filename; }
+
+    /** Number of entries. */
+    size_t size (void) const { return index.size(); }
+
+    /** Path of the ith entry, in index order. */
+    std::string getPath (size_t i) const;
+
+    /** Contents of the ith entry, in index order. */
+    Span<const char> get (size_t i) const;
+
+    /** Whether the archive contains the given canonical path. */
+    bool has (const std::string &path) const { return find(path) != NULL; }
+
+    /** Contents of the given canonical path, or throws an Exception. */
+    Span<const char> get (const std::string &path) const;
+
+    /** Hint the OS to read the given entry in before it is needed. */
+    void prefetch (const std::string &path);
+};
+
+/** Writes an archive in one pass.  Entries may be added in any order. */
+class ArchiveWriter {
+    BufferedOutFile out;
+    std::vector<ArchiveIndexEntry> index;
+    std::string strings;
+    bool finished;
+
+    public:
+
+    ArchiveWriter (const std::string &filename);
+
+    /** Finishes the archive if finish has not been called. */
+    ~ArchiveWriter (void);
+
+    /** Add an entry.  The path must be canonical and not already added. */
+    void add (const std::string &path, const void *data, size_t sz);
+
+    /** Add the contents of a file on disk. */
+    void addFile (const std::string &path, const std::string &filename);
+
+    /** Write the index and close the archive.  Throws if there were
+     * duplicate paths or a write error. */
+    void finish (void);
+};
+
+#endif
@@ -0,0 +1,175 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "async_read.h"
+
+namespace {
+
+    // Blocking reads on a pool of threads, for when the OS cannot do them
+    // asynchronously.
+    class ThreadBackend : public AsyncReadBackend {
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable jobCond, doneCond;
+        std::deque<AsyncReadRequest> jobs;
+        std::vector<AsyncReadResult> done;
+        bool quit;
+
+        static void read (const AsyncReadRequest &req, AsyncReadResult &res)
+        {
+            FILE *f = fopen(req.filename.c_str(), "rb");
+            if (f == NULL) {
+                res.error = req.filename + ": " + strerror(errno);
+                return;
+            }
+            #ifdef WIN32
+            int r = _fseeki64(f, req.offset, SEEK_SET);
+            #else
+            int r = fseeko(f, req.offset, SEEK_SET);
+            #endif
+            if (r != 0) {
+                res.error = req.filename + ": " + strerror(errno);
+            } else {
+                res.bytes = fread(req.buffer, 1, req.length, f);
+                if (ferror(f)) res.error = req.filename + ": " + strerror(errno);
+            }
+            fclose(f);
+        }
+
+        void work (void)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                jobCond.wait(lock, [this]{ return quit || !jobs.empty(); });
+                if (jobs.empty()) return;
+                AsyncReadRequest req = jobs.front();
+                jobs.pop_front();
+                lock.unlock();
+                AsyncReadResult res;
+                res.userData = req.userData;
+                res.buffer = req.buffer;
+                res.bytes = 0;
+                read(req, res);
+                lock.lock();
+                done.push_back(res);
+                doneCond.notify_all();
+            }
+        }
+
+        public:
+
+        ThreadBackend (unsigned threads)
+          : quit(false)
+        {
+            if (threads == 0) threads = 1;
+            for (unsigned i=0 ; i<threads ; ++i)
+                workers.push_back(std::thread(&ThreadBackend::work, this));
+        }
+
+        ~ThreadBackend (void)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+                jobs.clear();
+            }
+            jobCond.notify_all();
+            for (size_t i=0 ; i<workers.size() ; ++i) workers[i].join();
+        }
+
+        const char *name (void) const { return "threads"; }
+
+        void submit (const AsyncReadRequest &req)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(req);
+            }
+            jobCond.notify_one();
+        }
+
+        void reap (std::vector<AsyncReadResult> &out, size_t min)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            doneCond.wait(lock, [&]{ return done.size() >= min; });
+            out.insert(out.end(), done.begin(), done.end());
+            done.clear();
+        }
+    };
+
+}
+
+AsyncReadBackend *async_read_backend_threads (unsigned threads)
+{
+    return new ThreadBackend(threads);
+}
+
+AsyncFileReader::AsyncFileReader (unsigned queue_depth, unsigned threads, bool use_io_uring)
+  : backend(NULL), pending(0)
+{
+    if (use_io_uring) backend = async_read_backend_io_uring(queue_depth);
+    if (backend == NULL) backend = async_read_backend_threads(threads);
+}
+
+AsyncFileReader::~AsyncFileReader (void)
+{
+    // The buffers belong to the caller, so let reads in flight finish before
+    // it frees them.
+    std::vector<AsyncReadResult> dropped;
+    backend->reap(dropped, pending);
+    delete backend;
+}
+
+void AsyncFileReader::submit (Span<const AsyncReadRequest> reqs)
+{
+    for (size_t i=0 ; i<reqs.size() ; ++i) {
+        backend->submit(reqs[i]);
+        pending++;
+    }
+}
+
+size_t AsyncFileReader::poll (std::vector<AsyncReadResult> &out, size_t min_complete)
+{
+    if (min_complete > pending) min_complete = pending;
+    size_t before = out.size();
+    backend->reap(out, min_complete);
+    size_t got = out.size() - before;
+    pending -= got;
+    return got;
+}
+
+size_t AsyncFileReader::poll (const Callback &cb, size_t min_complete)
+{
+    // Not a member, as cb may poll again.
+    std::vector<AsyncReadResult> results;
+    size_t got = poll(results, min_complete);
+    for (size_t i=0 ; i<results.size() ; ++i) cb(results[i]);
+    return got;
+}
@@ -0,0 +1,112 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef ASYNC_READ_H
+#define ASYNC_READ_H
+
+#include <cstdlib>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "span.h"
+
+/** A read of part of a file into a caller supplied buffer. */
+struct AsyncReadRequest {
+    std::string filename;
+    unsigned long long offset;
+    size_t length;
+    void *buffer;       // at least length bytes, untouched until completion
+    void *userData;     // passed back in the result
+};
+
+/** The outcome of an AsyncReadRequest. */
+struct AsyncReadResult {
+    void *userData;
+    void *buffer;
+    size_t bytes;       // less than the length requested if the file ended
+    std::string error;  // empty on success
+    bool ok (void) const { return error.empty(); }
+};
+
+/** A way of doing the reads, see AsyncFileReader. */
+class AsyncReadBackend {
+    public:
+    virtual ~AsyncReadBackend (void) { }
+    virtual const char *name (void) const = 0;
+    /** Start the read.  May block to open the file, but not to read it. */
+    virtual void submit (const AsyncReadRequest &req) = 0;
+    /** Append completed reads to out, waiting until there are at least min. */
+    virtual void reap (std::vector<AsyncReadResult> &out, size_t min) = 0;
+};
+
+/** Returns NULL if io_uring is not available (not Linux, too old a kernel, or
+ * disabled by a sandbox).  Implemented per platform. */
+AsyncReadBackend *async_read_backend_io_uring (unsigned queue_depth);
+
+AsyncReadBackend *async_read_backend_threads (unsigned threads);
+
+/** Reads many files, or many parts of files, at the same time.  Requests
+ * are submitted in batches and completions are collected later by polling,
+ * in whatever order they finish.  Uses io_uring where it is available,
+ * otherwise a pool of threads doing ordinary blocking reads.
+ *
+ * Not thread safe: submit and poll from one thread.
+ */
+class AsyncFileReader {
+    AsyncReadBackend *backend;
+    size_t pending;
+
+    AsyncFileReader (const AsyncFileReader &) = delete;
+    AsyncFileReader &operator= (const AsyncFileReader &) = delete;
+
+    public:
+
+    typedef std::function<void (const AsyncReadResult &)> Callback;
+
+    /** \param queue_depth Maximum reads in flight with io_uring.
+     * \param threads Size of the thread pool otherwise.
+     * \param use_io_uring Set false to always use the thread pool. */
+    AsyncFileReader (unsigned queue_depth=64, unsigned threads=4, bool use_io_uring=true);
+    ~AsyncFileReader (void);
+
+    /** "io_uring" or "threads". */
+    const char *backendName (void) const { return backend->name(); }
+
+    /** Number of reads submitted and not yet returned by poll. */
+    size_t getPending (void) const { return pending; }
+
+    void submit (Span<const AsyncReadRequest> reqs);
+
+    /** Append completed reads to out, waiting until there are at least
+     * min_complete (or nothing is pending).  Returns the number appended. */
+    size_t poll (std::vector<AsyncReadResult> &out, size_t min_complete=0);
+
+    /** As above but calls cb for each completed read.  The callback may
+     * submit and poll again. */
+    size_t poll (const Callback &cb, size_t min_complete=0);
+
+    /** Wait for everything pending, calling cb for each. */
+    void wait (const Callback &cb) { poll(cb, pending); }
+};
+
+#endif
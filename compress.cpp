@@ -0,0 +1,481 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <thread>
+
+#include "compress.h"
+#include "console.h"
+
+static const char compress_magic[4] = { 'G', 'C', 'M', 'P' };
+static const unsigned compress_version = 1;
+
+static const size_t header_size = 4 + 4 + 4;
+static const size_t trailer_size = 4 + 4 + 8 + 8 + 8;
+
+static_assert(sizeof(CompressedBlockEntry) == 24, "CompressedBlockEntry has padding");
+
+
+// {{{ LZ codec
+
+namespace {
+
+    // Format of a block: a sequence of (literals, match) pairs, each
+    //   token       high 4 bits literal length, low 4 bits match length - 4
+    //   [length]    if literal length was 15, more bytes of it: 255 means
+    //               add 255 and continue, less ends it
+    //   literals
+    //   offset      u16, distance back to the start of the match
+    //   [length]    more match length, as for the literals
+    // The last pair stops after the literals.
+
+    const size_t MIN_MATCH = 4;
+    const size_t MAX_OFFSET = 65535;
+    const unsigned HASH_BITS = 14;
+
+    inline unsigned read32 (const char *p)
+    {
+        unsigned v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+
+    inline unsigned hash32 (unsigned v)
+    {
+        return (v * 2654435761U) >> (32 - HASH_BITS);
+    }
+
+    class LZCodec : public Codec {
+
+        static bool putLength (char *&op, char *end, size_t len)
+        {
+            while (len >= 255) {
+                if (op >= end) return false;
+                *op++ = char(255);
+                len -= 255;
+            }
+            if (op >= end) return false;
+            *op++ = char(len);
+            return true;
+        }
+
+        static bool getLength (const unsigned char *&ip, const unsigned char *end, size_t &len)
+        {
+            while (true) {
+                if (ip >= end) return false;
+                unsigned char b = *ip++;
+                len += b;
+                if (b != 255) return true;
+            }
+        }
+
+        // Write literals [lit, lit+lit_len) then a match, or no match if
+        // match_len is 0.
+        static bool putSequence (char *&op, char *end, const char *lit, size_t lit_len,
+                                 size_t offset, size_t match_len)
+        {
+            if (op >= end) return false;
+            char *token = op++;
+            unsigned char t = (lit_len >= 15 ? 15 : lit_len) << 4;
+            if (lit_len >= 15 && !putLength(op, end, lit_len - 15)) return false;
+            if (size_t(end - op) < lit_len) return false;
+            memcpy(op, lit, lit_len);
+            op += lit_len;
+            if (match_len > 0) {
+                if (end - op < 2) return false;
+                *op++ = char(offset & 0xff);
+                *op++ = char(offset >> 8);
+                size_t ml = match_len - MIN_MATCH;
+                t |= ml >= 15 ? 15 : ml;
+                if (ml >= 15 && !putLength(op, end, ml - 15)) return false;
+            }
+            *token = char(t);
+            return true;
+        }
+
+        public:
+
+        unsigned char id (void) const { return 1; }
+
+        const char *name (void) const { return "lz"; }
+
+        size_t compress (const char *src, size_t n, char *dst, size_t cap) const
+        {
+            std::vector<unsigned> table(size_t(1) << HASH_BITS, 0);
+            char *op = dst;
+            char *end = dst + cap;
+            size_t anchor = 0;
+            size_t ip = 1;
+            // Leave room to read 4 bytes at ip.
+            size_t limit = n < MIN_MATCH ? 0 : n - MIN_MATCH;
+            while (ip < limit) {
+                unsigned seq = read32(src + ip);
+                unsigned &slot = table[hash32(seq)];
+                size_t ref = slot;
+                slot = unsigned(ip);
+                if (ref >= ip || ip - ref > MAX_OFFSET || read32(src + ref) != seq) {
+                    ip++;
+                    continue;
+                }
+                size_t len = MIN_MATCH;
+                while (ip + len < n && src[ref + len] == src[ip + len]) len++;
+                if (!putSequence(op, end, src + anchor, ip - anchor, ip - ref, len)) return 0;
+                ip += len;
+                anchor = ip;
+            }
+            if (!putSequence(op, end, src + anchor, n - anchor, 0, 0)) return 0;
+            return op - dst;
+        }
+
+        bool decompress (const char *src, size_t n, char *dst, size_t out_n) const
+        {
+            const unsigned char *ip = reinterpret_cast<const unsigned char*>(src);
+            const unsigned char *iend = ip + n;
+            char *op = dst;
+            char *oend = dst + out_n;
+            while (true) {
+                if (ip >= iend) return false;
+                unsigned char t = *ip++;
+                size_t lit_len = t >> 4;
+                if (lit_len == 15 && !getLength(ip, iend, lit_len)) return false;
+                if (size_t(iend - ip) < lit_len || size_t(oend - op) < lit_len) return false;
+                memcpy(op, ip, lit_len);
+                ip += lit_len;
+                op += lit_len;
+                if (ip == iend) break;
+                if (iend - ip < 2) return false;
+                size_t offset = ip[0] | (size_t(ip[1]) << 8);
+                ip += 2;
+                size_t len = t & 15;
+                if (len == 15 && !getLength(ip, iend, len)) return false;
+                len += MIN_MATCH;
+                if (offset == 0 || offset > size_t(op - dst)) return false;
+                if (size_t(oend - op) < len) return false;
+                const char *m = op - offset;
+                if (offset >= len) {
+                    memcpy(op, m, len);
+                } else {
+                    // Overlaps what it produces, so byte at a time.
+                    for (size_t i=0 ; i<len ; ++i) op[i] = m[i];
+                }
+                op += len;
+            }
+            return op == oend;
+        }
+    };
+
+    LZCodec lz_codec;
+
+    const Codec *codecs[256] = { NULL };
+
+}
+
+const Codec *codec_lz (void)
+{
+    return &lz_codec;
+}
+
+void codec_register (const Codec *codec)
+{
+    unsigned char id = codec->id();
+    if (id == 0) {
+        EXCEPT << "Codec \"" << codec->name() << "\" uses reserved id 0" << ENDL;
+    }
+    if (codecs[id] != NULL && codecs[id] != codec) {
+        EXCEPT << "Codec \"" << codec->name() << "\" has the same id as \""
+               << codecs[id]->name() << "\"" << ENDL;
+    }
+    codecs[id] = codec;
+}
+
+const Codec *codec_get (unsigned char id)
+{
+    if (id == lz_codec.id()) return &lz_codec;
+    return codecs[id];
+}
+
+// }}}
+
+
+// {{{ CompressedSink
+
+CompressedSink::CompressedSink (const std::string &filename, const Codec *codec,
+                                size_t block_size, unsigned threads)
+  : out(filename, ENDIAN_LITTLE), codec(codec), blockSize(block_size),
+    threads(threads == 0 ? 1 : threads), current(block_size), used(0), total(0),
+    finished(false)
+{
+    if (block_size == 0 || block_size > 0x7fffffff) {
+        EXCEPT << filename << ": Invalid block size " << block_size << ENDL;
+    }
+    out.write_bytes(compress_magic, 4);
+    out.write(compress_version);
+    out.write((unsigned)block_size);
+}
+
+CompressedSink::~CompressedSink (void)
+{
+    if (finished) return;
+    try {
+        finish();
+    } catch (const Exception &e) {
+        CERR << e << std::endl;
+    }
+}
+
+void CompressedSink::compressBlocks (void)
+{
+    size_t n = blocks.size();
+    std::vector<std::vector<char> > compressed(n);
+    std::vector<size_t> sizes(n);
+    const Codec *c = codec;
+    auto work = [&](size_t first, size_t step) {
+        for (size_t i=first ; i<n ; i+=step) {
+            const std::vector<char> &raw = blocks[i];
+            // No point keeping it compressed unless it is smaller.
+            compressed[i].resize(raw.size());
+            sizes[i] = c->compress(&raw[0], raw.size(), &compressed[i][0], raw.size() - 1);
+        }
+    };
+    if (threads > 1 && n > 1) {
+        std::vector<std::thread> pool;
+        for (size_t t=1 ; t<threads && t<n ; ++t)
+            pool.push_back(std::thread(work, t, std::min<size_t>(threads, n)));
+        work(0, std::min<size_t>(threads, n));
+        for (size_t t=0 ; t<pool.size() ; ++t) pool[t].join();
+    } else {
+        work(0, 1);
+    }
+    for (size_t i=0 ; i<n ; ++i) {
+        CompressedBlockEntry e;
+        e.offset = out.tell();
+        e.size = unsigned(blocks[i].size());
+        e.reserved = 0;
+        if (sizes[i] > 0) {
+            e.codec = codec->id();
+            e.compressedSize = unsigned(sizes[i]);
+            out.write_bytes(&compressed[i][0], sizes[i]);
+        } else {
+            e.codec = 0;
+            e.compressedSize = e.size;
+            out.write_bytes(&blocks[i][0], blocks[i].size());
+        }
+        index.push_back(e);
+    }
+    blocks.clear();
+}
+
+void CompressedSink::append (const char *data, size_t sz)
+{
+    while (sz > 0) {
+        size_t n = std::min(sz, blockSize - used);
+        memcpy(&current[used], data, n);
+        used += n;
+        total += n;
+        data += n;
+        sz -= n;
+        if (used == blockSize) {
+            blocks.push_back(std::vector<char>());
+            blocks.back().swap(current);
+            current.resize(blockSize);
+            used = 0;
+            if (blocks.size() >= threads) compressBlocks();
+        }
+    }
+}
+
+std::string CompressedSink::write (const Span<const char> *bufs, size_t n)
+{
+    if (finished) return "Cannot write after the compressed file is finished";
+    try {
+        for (size_t i=0 ; i<n ; ++i) append(bufs[i].data(), bufs[i].size());
+    } catch (const Exception &e) {
+        return e.msg;
+    }
+    return "";
+}
+
+std::string CompressedSink::sync (void)
+{
+    try {
+        out.sync();
+    } catch (const Exception &e) {
+        return e.msg;
+    }
+    return "";
+}
+
+void CompressedSink::finish (void)
+{
+    if (finished) return;
+    finished = true;
+    if (used > 0) {
+        current.resize(used);
+        blocks.push_back(current);
+        used = 0;
+    }
+    compressBlocks();
+
+    static const char zeroes[8] = { 0 };
+    out.write_bytes(zeroes, (8 - out.tell() % 8) % 8);
+    unsigned long long index_offset = out.tell();
+    for (size_t i=0 ; i<index.size() ; ++i) {
+        const CompressedBlockEntry &e = index[i];
+        out.write(e.offset);
+        out.write(e.compressedSize);
+        out.write(e.size);
+        out.write(e.codec);
+        out.write(e.reserved);
+    }
+    out.write_bytes(compress_magic, 4);
+    out.write(compress_version);
+    out.write((unsigned long long)index.size());
+    out.write(index_offset);
+    out.write(total);
+    out.flush();
+}
+
+// }}}
+
+
+// {{{ CompressedSource
+
+template<class T> static T get_le (const char *p)
+{
+    T v;
+    memcpy(&v, p, sizeof v);
+    return endian_little(v);
+}
+
+CompressedSource::CompressedSource (const std::string &filename)
+  : file(filename), pos(0), cachedBlock(0)
+{
+    const char *base = file.data();
+    size_t sz = file.size();
+    if (sz < header_size + trailer_size || memcmp(base, compress_magic, 4) != 0) {
+        EXCEPT << filename << ": Not a compressed file" << ENDL;
+    }
+    const char *t = base + sz - trailer_size;
+    unsigned version = get_le<unsigned>(t + 4);
+    if (memcmp(t, compress_magic, 4) != 0 || version != compress_version
+        || get_le<unsigned>(base + 4) != compress_version) {
+        EXCEPT << filename << ": Unsupported or truncated compressed file" << ENDL;
+    }
+    blockSize = get_le<unsigned>(base + 8);
+    unsigned long long count = get_le<unsigned long long>(t + 8);
+    unsigned long long index_offset = get_le<unsigned long long>(t + 16);
+    total = get_le<unsigned long long>(t + 24);
+    index = file.view<CompressedBlockEntry>(index_offset, count);
+    unsigned long long expect = 0;
+    for (size_t i=0 ; i<index.size() ; ++i) {
+        const CompressedBlockEntry &e = index[i];
+        unsigned long long off = endian_little(e.offset);
+        unsigned long long csz = endian_little(e.compressedSize);
+        unsigned long long rsz = endian_little(e.size);
+        unsigned codec = endian_little(e.codec);
+        bool last = i + 1 == index.size();
+        if (off > sz || csz > sz - off || rsz > blockSize || (!last && rsz != blockSize)
+            || codec > 255 || (codec == 0 && csz != rsz)) {
+            EXCEPT << filename << ": Corrupt block index entry " << i << ENDL;
+        }
+        if (codec != 0 && codec_get((unsigned char)codec) == NULL) {
+            EXCEPT << filename << ": Block " << i << " uses unknown codec " << int(codec) << ENDL;
+        }
+        expect += rsz;
+    }
+    if (expect != total) {
+        EXCEPT << filename << ": Corrupt block index" << ENDL;
+    }
+    cachedBlock = index.size();
+}
+
+void CompressedSource::readBlock (size_t i, char *out) const
+{
+    const CompressedBlockEntry &e = index[i];
+    const char *src = file.data() + endian_little(e.offset);
+    size_t csz = endian_little(e.compressedSize);
+    size_t rsz = endian_little(e.size);
+    unsigned codec = endian_little(e.codec);
+    if (codec == 0) {
+        memcpy(out, src, rsz);
+        return;
+    }
+    if (!codec_get(codec)->decompress(src, csz, out, rsz)) {
+        EXCEPT << file.filename << ": Corrupt block " << i << ENDL;
+    }
+}
+
+void CompressedSource::readAll (void *out, unsigned threads) const
+{
+    char *dst = static_cast<char*>(out);
+    size_t n = index.size();
+    if (threads <= 1 || n <= 1) {
+        for (size_t i=0 ; i<n ; ++i) readBlock(i, dst + i * blockSize);
+        return;
+    }
+    size_t step = std::min<size_t>(threads, n);
+    std::vector<std::string> errors(step);
+    auto work = [&](size_t first) {
+        try {
+            for (size_t i=first ; i<n ; i+=step) readBlock(i, dst + i * blockSize);
+        } catch (const Exception &e) {
+            errors[first] = e.msg;
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t t=1 ; t<step ; ++t) pool.push_back(std::thread(work, t));
+    work(0);
+    for (size_t t=0 ; t<pool.size() ; ++t) pool[t].join();
+    for (size_t t=0 ; t<step ; ++t) {
+        if (!errors[t].empty()) throw Exception(errors[t]);
+    }
+}
+
+const char *CompressedSource::block (size_t i)
+{
+    if (cachedBlock != i) {
+        cache.resize(blockSize);
+        // Invalidate first in case readBlock throws.
+        cachedBlock = index.size();
+        readBlock(i, &cache[0]);
+        cachedBlock = i;
+    }
+    return &cache[0];
+}
+
+size_t CompressedSource::read (void *data, size_t sz)
+{
+    if (pos >= total) return 0;
+    if (sz > total - pos) sz = size_t(total - pos);
+    size_t got = sz;
+    char *dst = static_cast<char*>(data);
+    while (sz > 0) {
+        size_t i = size_t(pos / blockSize);
+        size_t off = size_t(pos % blockSize);
+        size_t n = std::min(sz, size_t(endian_little(index[i].size)) - off);
+        memcpy(dst, block(i) + off, n);
+        dst += n;
+        pos += n;
+        sz -= n;
+    }
+    return got;
+}
+
+// }}}
@@ -0,0 +1,182 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <string>
+#include <vector>
+
+#include "io_util.h"
+#include "span.h"
+
+/** A block compression algorithm.  Blocks are compressed independently, so
+ * a codec must not keep state between calls, and may be called from several
+ * threads at once. */
+class Codec {
+    public:
+    virtual ~Codec (void) { }
+
+    /** Identifies the codec in files.  0 is reserved for stored blocks. */
+    virtual unsigned char id (void) const = 0;
+
+    virtual const char *name (void) const = 0;
+
+    /** Compress n bytes of src into dst, which has room for cap bytes.
+     * Returns the compressed size, or 0 if it did not fit. */
+    virtual size_t compress (const char *src, size_t n, char *dst, size_t cap) const = 0;
+
+    /** Decompress n bytes of src into exactly out_n bytes at dst.  Returns
+     * false if the data is corrupt. */
+    virtual bool decompress (const char *src, size_t n, char *dst, size_t out_n) const = 0;
+};
+
+/** The built-in codec, a byte oriented LZ77 in the style of LZ4.  Fast to
+ * compress and very fast to decompress, with a modest ratio. */
+const Codec *codec_lz (void);
+
+/** Make a codec available to CompressedSource by its id. */
+void codec_register (const Codec *codec);
+
+/** The codec with the given id, or NULL. */
+const Codec *codec_get (unsigned char id);
+
+/* A compressed file is a sequence of independently compressed blocks, so
+ * that they can be (de)compressed in parallel and read in any order.
+ * Layout (little endian):
+ *
+ *   header     char[4] "GCMP", u32 version, u32 block size
+ *   blocks     each compressed, or stored if that did not help
+ *   index      CompressedBlockEntry[count], 8 byte aligned
+ *   trailer    char[4] "GCMP", u32 version, u64 count, u64 index offset,
+ *              u64 uncompressed size
+ */
+
+/** An entry of the block index, as it is on disk. */
+struct CompressedBlockEntry {
+    unsigned long long offset;
+    unsigned compressedSize;
+    unsigned size;
+    unsigned codec;             // 0 if the block is stored
+    unsigned reserved;
+};
+
+/** Compresses what a BufferedOutFile writes to it into a file, a block at a
+ * time.  The BufferedOutFile provides the buffering, byte order conversion
+ * and writev, so a BinaryWriter can be stacked on top as usual:
+ *
+ *     CompressedSink sink("save.gcmp");
+ *     BufferedOutFile f(sink, "save.gcmp", ENDIAN_LITTLE);
+ *     BinaryWriter w(f, "SAVE", 1);
+ *     ...
+ *     f.flush();
+ *     sink.finish();
+ *
+ * Declared in that order, the BufferedOutFile is flushed into the sink when
+ * it is destroyed, and the sink then finishes the file, so the last two calls
+ * are only needed to see errors.
+ */
+class CompressedSink : public OutSink {
+    BufferedOutFile out;
+    const Codec *codec;
+    const size_t blockSize;
+    const unsigned threads;
+    std::vector<std::vector<char> > blocks;     // full, not yet compressed
+    std::vector<char> current;                  // being filled
+    size_t used;
+    std::vector<CompressedBlockEntry> index;
+    unsigned long long total;
+    bool finished;
+
+    CompressedSink (const CompressedSink &) = delete;
+    CompressedSink &operator= (const CompressedSink &) = delete;
+
+    void compressBlocks (void);
+    void append (const char *data, size_t sz);
+
+    public:
+
+    /** \param threads Compress this many blocks at a time, in parallel. */
+    CompressedSink (const std::string &filename, const Codec *codec=codec_lz(),
+                    size_t block_size=256*1024, unsigned threads=1);
+
+    /** Finishes the file if finish has not been called. */
+    ~CompressedSink (void);
+
+    const std::string &getFilename (void) const { return out.filename; }
+
+    /** Uncompressed bytes received so far. */
+    unsigned long long tell (void) const { return total; }
+
+    /** Fails once the file is finished. */
+    std::string write (const Span<const char> *bufs, size_t n);
+
+    /** Only blocks that are full have been written, until finish. */
+    std::string sync (void);
+
+    /** Compress what is left and write the index.  Flush the BufferedOutFile
+     * first.  Throws on error. */
+    void finish (void);
+};
+
+/** Reads a file written through CompressedSink, via a memory mapping.  Stack
+ * a BufferedInFile on it for sequential reads (and a BinaryReader on that),
+ * or use it directly for random access to blocks and for decompressing the
+ * whole file on several threads. */
+class CompressedSource : public InSource {
+    MappedFile file;
+    Span<const CompressedBlockEntry> index;
+    unsigned long long total;
+    size_t blockSize;
+
+    unsigned long long pos;
+    size_t cachedBlock;                         // index.size() if none
+    std::vector<char> cache;
+
+    const char *block (size_t i);
+
+    public:
+
+    CompressedSource (const std::string &filename);
+
+    const std::string &getFilename (void) const { return file.filename; }
+
+    /** Uncompressed size. */
+    unsigned long long size (void) const { return total; }
+
+    size_t getBlockSize (void) const { return blockSize; }
+    size_t numBlocks (void) const { return index.size(); }
+
+    /** Decompress block i into out, which must have room for the block
+     * (getBlockSize bytes, or less for the last). */
+    void readBlock (size_t i, char *out) const;
+
+    /** Decompress the whole file into out, which must have room for size
+     * bytes, using the given number of threads. */
+    void readAll (void *out, unsigned threads=1) const;
+
+    /** Decompresses only the blocks it touches. */
+    size_t read (void *data, size_t sz);
+
+    void seek (unsigned long long offset) { pos = offset; }
+};
+
+#endif
@@ -19,7 +19,86 @@
  * THE SOFTWARE.
  */
 
+#include <cstring>
+
 #include "console.h"
+#include "sleep.h"
 
 void assert_triggered (void) { } 
 
+static std::atomic<int> report_mode(REPORT_RATE_LIMITED);
+static std::atomic<unsigned long long> report_interval(1000000);
+static std::atomic<unsigned long long> report_sample(100);
+
+// Every site that has ever failed, so that summaries can be printed.
+static std::atomic<ReportSite*> report_sites(nullptr);
+
+void report_set_mode (ReportMode mode, unsigned long long param)
+{
+    if (mode == REPORT_RATE_LIMITED) report_interval = param;
+    if (mode == REPORT_SAMPLED) report_sample = param == 0 ? 1 : param;
+    report_mode = mode;
+}
+
+bool report_site_hit (ReportSite &site, unsigned long &repeats)
+{
+    unsigned long hits = ++site.hits;
+
+    if (!site.registered.exchange(true)) {
+        site.next = report_sites.load();
+        while (!report_sites.compare_exchange_weak(site.next, &site)) { }
+    }
+
+    bool report;
+    switch (report_mode) {
+        case REPORT_ALL:
+        report = true;
+        break;
+
+        case REPORT_SAMPLED:
+        report = hits == 1 || hits % report_sample == 0;
+        break;
+
+        default: {
+            unsigned long long now = micros();
+            unsigned long long last = site.lastReport;
+            // Of several threads failing at once, only one reports.
+            report = (hits == 1 || now - last >= report_interval)
+                     && site.lastReport.compare_exchange_strong(last, now);
+        }
+    }
+
+    if (!report) {
+        site.suppressed++;
+        return false;
+    }
+    repeats = site.suppressed.exchange(0);
+    return true;
+}
+
+void report_sites_summarise (void)
+{
+    for (ReportSite *s = report_sites.load() ; s != nullptr ; s = s->next) {
+        unsigned long repeats = s->suppressed.exchange(0);
+        if (repeats == 0) continue;
+        CERR << "Assertion failed: " << s->what << " (" << s->file << ":" << s->line
+             << ") repeated " << repeats << " more times" << std::endl;
+    }
+}
+
+void assert_failed (ReportSite &site, int err)
+{
+    unsigned long repeats;
+    if (report_site_hit(site, repeats)) {
+        if (repeats > 0) {
+            CERR << "Assertion failed: " << site.what << " (repeated " << repeats
+                 << " more times)" << std::endl;
+        } else {
+            CERR << "Assertion failed: " << site.what << std::endl;
+        }
+        if (err > 0) CERR << "perror says: " << strerror(err) << std::endl;
+        if (err < 0) CERR << "perror says: Success" << std::endl;
+    }
+    assert_triggered();
+}
+
@@ -19,16 +19,20 @@
  * THE SOFTWARE.
  */
 
+#include <cerrno>
+
+#include <atomic>
 #include <map>
 #include <ostream>
 #include <set>
 #include <string>
 #include <vector>
 
-
 #ifndef CONSOLE_H
 #define CONSOLE_H
 
+#include "logger.h"
+
 /** ANSI terminal colour codes, used by the grit console to distinguish colours. */
 
 /*
@@ -69,9 +73,16 @@
 #endif
 */
 
-#ifndef CLOG
-#define CLOG std::cerr
-#endif
+/* By default, log through the asynchronous logger so that the calling thread
+ * only pays for formatting.  Defining CLOG (e.g. to std::cerr) before this
+ * header bypasses it, as before.
+ *
+ * These are std::ostream lvalues as they always were, unless LOG_MIN_LEVEL
+ * strips their level.  Then they become a void expression that still accepts
+ * <<, so "CVERB << x << std::endl" compiles to nothing, but code that binds
+ * or calls a method on the stream (std::ostream &o = CVERB; CVERB.flush())
+ * no longer compiles.  Use log_stream() directly for that. */
+#ifdef CLOG
 
 #ifndef CERR 
 #define CERR CLOG
@@ -81,17 +92,94 @@
 #define CVERB CLOG
 #endif
 
+#else
+
+#if LOG_MIN_LEVEL <= 1
+#define CLOG log_stream(LOG_INFO)
+#else
+#define CLOG LOG_STREAM(LOG_INFO)
+#endif
+
+#ifndef CERR 
+#if LOG_MIN_LEVEL <= 2
+#define CERR log_stream(LOG_ERROR)
+#else
+#define CERR LOG_STREAM(LOG_ERROR)
+#endif
+#endif
+
+#ifndef CVERB 
+#if LOG_MIN_LEVEL <= 0
+#define CVERB log_stream(LOG_VERBOSE)
+#else
+#define CVERB LOG_STREAM(LOG_VERBOSE)
+#endif
+#endif
+
+#endif
+
 /** Place to hook a debugger to trap assert failures that would otherwise just
- * keep executing.
+ * keep executing.  Called on every failure, including unreported ones.  CERR
+ * is synchronous, so the report has already been written by then.
  */
 void assert_triggered (void);
 
-/** An assert macro that uses CERR and assert_triggered.
+/** State for one call site whose reports are rate limited.  There is one of
+ * these per expansion of APP_ASSERT or PERROR_ASSERT, created the first time
+ * the assertion fails.  It is constant-initialised, so it costs nothing
+ * before that.
+ */
+struct ReportSite {
+    const char *what;
+    const char *file;
+    int line;
+    std::atomic<unsigned long> hits;        // total failures
+    std::atomic<unsigned long> suppressed;  // since the last report
+    std::atomic<unsigned long long> lastReport;  // micros()
+    std::atomic<bool> registered;
+    ReportSite *next;
+
+    constexpr ReportSite (const char *what, const char *file, int line)
+      : what(what), file(file), line(line), hits(0), suppressed(0),
+        lastReport(0), registered(false), next(nullptr)
+    { }
+};
+
+enum ReportMode {
+    REPORT_ALL,             // every failure
+    REPORT_RATE_LIMITED,    // at most one per site per interval (default 1s)
+    REPORT_SAMPLED          // the first and then every Nth (default 100)
+};
+
+/** Choose how often a failing site is reported.
+ * \param param The interval in microseconds for REPORT_RATE_LIMITED, or N for
+ * REPORT_SAMPLED.  Ignored for REPORT_ALL.
+ */
+void report_set_mode (ReportMode mode, unsigned long long param);
+
+/** Count a failure at the site, and decide whether to report it.
+ * \param repeats Set to the number of unreported failures since the last
+ * report, if returning true.
+ */
+bool report_site_hit (ReportSite &site, unsigned long &repeats);
+
+/** Print a "repeated N times" line for every site that has failed since it
+ * was last reported, e.g. once per frame or at shutdown.
+ */
+void report_sites_summarise (void);
+
+/** Report an assertion failure at the site, subject to the report mode.
+ * \param err The errno to print, or 0.
+ */
+void assert_failed (ReportSite &site, int err);
+
+/** An assert macro that uses CERR and assert_triggered.  Repeated failures
+ * are rate limited per call site, see report_set_mode.
  */
 #define APP_ASSERT(cond) do { \
     if (!(cond)) { \
-        CERR << "Assertion failed: " << #cond << std::endl; \
-        assert_triggered(); \
+        static ReportSite assert_site_(#cond, __FILE__, __LINE__); \
+        assert_failed(assert_site_, 0); \
     } \
 } while (0)
 
@@ -99,9 +187,9 @@ void assert_triggered (void);
  */
 #define PERROR_ASSERT(cond) do { \
     if (!(cond)) {\
-        CERR << "Assertion failed: " << #cond << std::endl; \
-        perror("perror says"); \
-        assert_triggered(); \
+        int assert_errno_ = errno; \
+        static ReportSite assert_site_(#cond, __FILE__, __LINE__); \
+        assert_failed(assert_site_, assert_errno_ == 0 ? -1 : assert_errno_); \
     } \
 } while (0)
 
@@ -0,0 +1,135 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <mutex>
+
+#include "cycle_clock.h"
+
+std::atomic<const CycleClockParams*> cycle_clock_params(nullptr);
+
+// A pair of readings of both clocks, from the first calibration.
+static unsigned long long start_cycles, start_nanos;
+static std::mutex calibrate_mutex;
+
+bool cycle_clock_invariant (void)
+{
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
+    unsigned regs[4];
+    #ifdef _MSC_VER
+    __cpuid(reinterpret_cast<int*>(regs), 0x80000000);
+    #else
+    __asm__ __volatile__ ("cpuid" : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+                                  : "a" (0x80000000), "c" (0));
+    #endif
+    if (regs[0] < 0x80000007) return false;
+    #ifdef _MSC_VER
+    __cpuid(reinterpret_cast<int*>(regs), 0x80000007);
+    #else
+    __asm__ __volatile__ ("cpuid" : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+                                  : "a" (0x80000007), "c" (0));
+    #endif
+    // Advanced power management: invariant TSC.
+    return (regs[3] & (1 << 8)) != 0;
+#elif defined(__aarch64__)
+    // The architected generic timer has a fixed frequency.
+    return true;
+#else
+    return false;
+#endif
+}
+
+double cycle_clock_frequency (void)
+{
+    const CycleClockParams *p = cycle_clock_params.load(std::memory_order_acquire);
+    return p == nullptr ? 0 : 1e9 / p->nanosPerCycle;
+}
+
+// Read both clocks as close together as possible, by taking the pair
+// with the shortest gap between the cycle readings.
+static void read_both (unsigned long long &c, unsigned long long &ns)
+{
+    unsigned long long best = ~0ULL;
+    c = ns = 0;
+    for (int i=0 ; i<5 ; ++i) {
+        unsigned long long c0 = cycle_counter();
+        unsigned long long n = clock_nanos();
+        unsigned long long c1 = cycle_counter();
+        if (c1 - c0 < best) {
+            best = c1 - c0;
+            c = c0 + (c1 - c0) / 2;
+            ns = n;
+        }
+    }
+}
+
+static bool install (unsigned long long c0, unsigned long long n0,
+                     unsigned long long c1, unsigned long long n1)
+{
+    if (c1 <= c0 || n1 <= n0) return false;
+    double nanos_per_cycle = double(n1 - n0) / double(c1 - c0);
+    // Below 1MHz or above 100GHz, something is wrong.
+    if (nanos_per_cycle > 1000 || nanos_per_cycle < 0.01) return false;
+
+    CycleClockParams *p = new CycleClockParams;
+    p->baseCycles = c1;
+    // Continue from the old estimate, so nanos() never jumps.
+    const CycleClockParams *old = cycle_clock_params.load();
+    if (old == nullptr) {
+        p->baseNanos = n1;
+    } else {
+        long long delta = (long long)(c1 - old->baseCycles);
+        p->baseNanos = old->baseNanos + (long long)(delta * old->nanosPerCycle);
+    }
+    p->nanosPerCycle = nanos_per_cycle;
+    // The old parameters are leaked, since another thread may be using them.
+    cycle_clock_params.store(p, std::memory_order_release);
+    return true;
+}
+
+bool cycle_clock_calibrate (unsigned long long sample_ns)
+{
+    std::lock_guard<std::mutex> lock(calibrate_mutex);
+    if (!cycle_clock_invariant()) return false;
+    unsigned long long c0, n0, c1, n1;
+    read_both(c0, n0);
+    mysleep_until(n0 + sample_ns);
+    read_both(c1, n1);
+    if (start_nanos == 0) {
+        start_cycles = c0;
+        start_nanos = n0;
+    }
+    return install(c0, n0, c1, n1);
+}
+
+void cycle_clock_recalibrate (void)
+{
+    std::lock_guard<std::mutex> lock(calibrate_mutex);
+    if (start_nanos == 0) return;
+    unsigned long long c1, n1;
+    read_both(c1, n1);
+    install(start_cycles, start_nanos, c1, n1);
+}
+
+namespace {
+    struct Init {
+        Init (void) { cycle_clock_calibrate(10000000); }
+    } init;
+}
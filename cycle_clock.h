@@ -0,0 +1,120 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef CYCLE_CLOCK_H
+#define CYCLE_CLOCK_H
+
+#include <atomic>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+#include "sleep.h"
+
+/** The raw cycle counter: rdtsc on x86, the virtual counter on ARM64,
+ * otherwise clock_nanos().  Only meaningful relative to another reading on
+ * the same machine, and only comparable across cores if
+ * cycle_clock_invariant() is true.  Use cycles() instead. */
+static inline unsigned long long cycle_counter (void)
+{
+#if defined(_MSC_VER) || defined(__i386__) || defined(__x86_64__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    unsigned long long v;
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (v));
+    return v;
+#else
+    return clock_nanos();
+#endif
+}
+
+/** How to turn cycle_counter() into nanoseconds.  Replaced, never modified, so
+ * that readers need no lock. */
+struct CycleClockParams {
+    unsigned long long baseCycles;
+    unsigned long long baseNanos;
+    double nanosPerCycle;
+};
+
+/** NULL until calibrated, or if the counter cannot be trusted. */
+extern std::atomic<const CycleClockParams*> cycle_clock_params;
+
+/** The cycle counter if it has been calibrated, otherwise clock_nanos(), so
+ * that the conversions below are always right.  Calibration is done during
+ * static initialisation, so only readings taken before that are in other
+ * units than later ones. */
+static inline unsigned long long cycles (void)
+{
+    if (cycle_clock_params.load(std::memory_order_acquire) == nullptr) return clock_nanos();
+    return cycle_counter();
+}
+
+/** Nanoseconds on the same timeline as clock_nanos(), but read from the
+ * cycle counter, so a few nanoseconds instead of a clock_gettime call.
+ * Falls back to clock_nanos() if the counter is unusable. */
+static inline unsigned long long nanos (void)
+{
+    const CycleClockParams *p = cycle_clock_params.load(std::memory_order_acquire);
+    if (p == nullptr) return clock_nanos();
+    long long delta = (long long)(cycle_counter() - p->baseCycles);
+    return p->baseNanos + (long long)(delta * p->nanosPerCycle);
+}
+
+/** Whether the counter runs at a constant rate regardless of power state and
+ * is synchronised across cores.  If not, nanos() uses clock_nanos(). */
+bool cycle_clock_invariant (void);
+
+/** Counter ticks per second, or 0 if not calibrated, in which case cycles()
+ * counts nanoseconds. */
+double cycle_clock_frequency (void);
+
+/** Measure the counter against clock_nanos() over the given time.  This is
+ * done for 10ms at startup.  Calling it again later with the time since
+ * startup gives a more accurate rate, and nanos() stays continuous.
+ * Returns false if the counter is unusable. */
+bool cycle_clock_calibrate (unsigned long long sample_ns);
+
+/** Refine the startup calibration without waiting, using all the time that
+ * has passed since then. */
+void cycle_clock_recalibrate (void);
+
+/** Convert a difference of cycles() readings. */
+static inline double cycles_to_nanos (long long c)
+{
+    double f = cycle_clock_frequency();
+    return f > 0 ? c * 1e9 / f : double(c);
+}
+
+static inline double cycles_to_seconds (long long c)
+{
+    return cycles_to_nanos(c) / 1e9;
+}
+
+static inline long long nanos_to_cycles (double ns)
+{
+    double f = cycle_clock_frequency();
+    return (long long)(f > 0 ? ns * f / 1e9 : ns);
+}
+
+#endif
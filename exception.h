@@ -22,17 +22,30 @@
 #ifndef EXCEPTION_H
 #define EXCEPTION_H
 
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <type_traits>
+#include <utility>
 
 #include "intrinsics.h"
 
 #define EXCEPTEX ExceptionStream(__FILE__,__LINE__)
-#define EXCEPT ExceptionStream()
 #define ENDL ExceptionStream::EndL()
 
+// Define EXCEPTION_SOURCE_LOCATION to record where every EXCEPT was thrown
+// from in Exception::file and Exception::line.  The message is unchanged.
+#ifdef EXCEPTION_SOURCE_LOCATION
+#define EXCEPT ExceptionStream(ExceptionStream::Here(),__FILE__,__LINE__)
+#else
+#define EXCEPT ExceptionStream()
+#endif
+
 #define ASSERT(x) do { if (!(x)) { EXCEPTEX << "Assertion failed: " << #x << std::endl; } } while (0)
 
 #define HANDLE_BEGIN try {
@@ -42,29 +55,96 @@
 
 /** Simple exception object encapsulates a string. */
 struct Exception {
-    const std::string msg;
-    Exception(const std::string &msg)
-      : msg(msg) { }
+    std::string msg;
+    const char *file;   // NULL unless built with EXCEPTION_SOURCE_LOCATION
+    int line;
+    Exception(std::string msg, const char *file=NULL, int line=0)
+      : msg(std::move(msg)), file(file), line(line) { }
 };
 
 /** Allows printing an exception to a stream. */
 inline std::ostream &operator << (std::ostream &o, const Exception &e)
 { o << e.msg; return o; }
 
+/** Builds the message of an Exception and throws it at ENDL or std::endl.
+ *
+ * Strings and numbers are formatted straight into a small inline buffer, so
+ * the common case does not allocate until the message is handed to the
+ * Exception.  Anything else (or a manipulator such as std::hex) switches to
+ * a std::ostringstream for the rest of the message, so formatting is the
+ * same as it would be on any other stream.
+ */
 class ExceptionStream {
 
-    std::stringstream ss;
+    static const size_t INLINE = 200;
+
+    char buf[INLINE];
+    size_t len;
+    std::string heap;                       // once buf is full
+    std::unique_ptr<std::ostringstream> ss; // once something needs a stream
+    const char *file;
+    int line;
+
+    void append (const char *s, size_t n)
+    {
+        if (ss) {
+            ss->write(s, n);
+        } else if (heap.empty() && n <= INLINE - len) {
+            memcpy(buf + len, s, n);
+            len += n;
+        } else {
+            if (heap.empty()) heap.assign(buf, len);
+            heap.append(s, n);
+        }
+    }
+
+    std::ostream &stream (void)
+    {
+        if (!ss) {
+            ss.reset(new std::ostringstream());
+            if (heap.empty()) ss->write(buf, len);
+            else ss->write(heap.data(), heap.size());
+        }
+        return *ss;
+    }
+
+    template<class T> ExceptionStream &number (const char *fmt, T v)
+    {
+        if (ss) {
+            *ss << v;
+        } else {
+            char tmp[32];
+            int n = snprintf(tmp, sizeof tmp, fmt, v);
+            append(tmp, n);
+        }
+        return *this;
+    }
+
+    std::string take (void)
+    {
+        if (ss) return ss->str();
+        if (!heap.empty()) return std::move(heap);
+        return std::string(buf, len);
+    }
 
     public:
 
     struct EndL { };
+    struct Here { };
 
     ExceptionStream (const char *file, int line)
+      : len(0), file(NULL), line(0)
     {
         (*this)<<"Internal error at: ("<<file<<":"<<line<<"): ";
     }
 
+    ExceptionStream (Here, const char *file, int line)
+      : len(0), file(file), line(line)
+    {
+    }
+
     ExceptionStream (void)
+      : len(0), file(NULL), line(0)
     {
     }
 
@@ -76,25 +156,101 @@ class ExceptionStream {
 
     NORETURN1 ExceptionStream &operator<< (EndL) NORETURN2
     {
-        throw Exception(ss.str());
+        throw Exception(take(), file, line);
     }
 
     ExceptionStream &operator<< (manip *o)
     {
         if (o == (manip*)std::endl) {
-            throw Exception(ss.str());
+            throw Exception(take(), file, line);
         } else {
-            ss << o;
+            stream() << o;
         }
         return *this;
     }
 
+    ExceptionStream &operator<< (const char *o) { append(o, strlen(o)); return *this; }
+    ExceptionStream &operator<< (char *o) { append(o, strlen(o)); return *this; }
+    ExceptionStream &operator<< (const std::string &o) { append(o.data(), o.length()); return *this; }
+    ExceptionStream &operator<< (char o) { append(&o, 1); return *this; }
+    ExceptionStream &operator<< (int o) { return number("%d", o); }
+    ExceptionStream &operator<< (long o) { return number("%ld", o); }
+    ExceptionStream &operator<< (long long o) { return number("%lld", o); }
+    ExceptionStream &operator<< (unsigned o) { return number("%u", o); }
+    ExceptionStream &operator<< (unsigned long o) { return number("%lu", o); }
+    ExceptionStream &operator<< (unsigned long long o) { return number("%llu", o); }
+    // Same as the default precision of a stream.
+    ExceptionStream &operator<< (double o) { return number("%g", o); }
+    ExceptionStream &operator<< (float o) { return number("%g", double(o)); }
+
     template<typename T> ExceptionStream &operator<<(T const &o)
     {
-        ss << o;
+        stream() << o;
         return *this;
     }
 
 };
 
+/** Wraps Expected's error message, to tell it apart from a value. */
+struct Unexpected {
+    std::string msg;
+    explicit Unexpected (std::string msg) : msg(std::move(msg)) { }
+};
+
+/** Either a value or the message of what went wrong, for functions that are
+ * expected to fail often enough that throwing would be too slow, or where
+ * the caller just wants to test.  E.g.
+ *
+ *   Expected<std::string> p = try_absolute_path(dir, rel);
+ *   if (!p) CERR << p.error() << std::endl;
+ *   else use(*p);
+ */
+template<class T> class Expected {
+    bool ok;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    std::string err;
+
+    T *ptr (void) { return reinterpret_cast<T*>(&storage); }
+    const T *ptr (void) const { return reinterpret_cast<const T*>(&storage); }
+
+    public:
+
+    Expected (const T &v) : ok(true) { new (&storage) T(v); }
+    Expected (T &&v) : ok(true) { new (&storage) T(std::move(v)); }
+    Expected (Unexpected e) : ok(false), err(std::move(e.msg)) { }
+
+    Expected (const Expected &o) : ok(o.ok), err(o.err)
+    { if (ok) new (&storage) T(*o.ptr()); }
+    Expected (Expected &&o) : ok(o.ok), err(std::move(o.err))
+    { if (ok) new (&storage) T(std::move(*o.ptr())); }
+
+    ~Expected (void) { if (ok) ptr()->~T(); }
+
+    Expected &operator= (Expected o)
+    {
+        if (ok) ptr()->~T();
+        ok = o.ok;
+        err = std::move(o.err);
+        if (ok) new (&storage) T(std::move(*o.ptr()));
+        return *this;
+    }
+
+    bool hasValue (void) const { return ok; }
+    explicit operator bool (void) const { return ok; }
+
+    /** Throws an Exception with the error message if there is no value. */
+    T &value (void) { if (!ok) throw Exception(err); return *ptr(); }
+    const T &value (void) const { if (!ok) throw Exception(err); return *ptr(); }
+
+    T &operator* (void) { return value(); }
+    const T &operator* (void) const { return value(); }
+    T *operator-> (void) { return &value(); }
+    const T *operator-> (void) const { return &value(); }
+
+    T valueOr (const T &def) const { return ok ? *ptr() : def; }
+
+    /** Empty if there is a value. */
+    const std::string &error (void) const { return err; }
+};
+
 #endif
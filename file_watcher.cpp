@@ -0,0 +1,197 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "file_watcher.h"
+#include "lua_util.h"
+#include "sleep.h"
+
+const char *to_string (FileEvent::Kind k)
+{
+    switch (k) {
+        case FileEvent::CREATED: return "created";
+        case FileEvent::MODIFIED: return "modified";
+        case FileEvent::DELETED: return "deleted";
+        case FileEvent::RENAMED: return "renamed";
+    }
+    return "unknown";
+}
+
+FileWatcher::FileWatcher (unsigned long long debounce_us)
+  : fd(-1), debounce(debounce_us)
+{
+    osOpen();
+}
+
+FileWatcher::~FileWatcher (void)
+{
+    osClose();
+}
+
+void FileWatcher::watch (const std::string &dir, const std::string &path)
+{
+    osAddWatch(dir, path);
+}
+
+// Merge e into whatever is pending for the same path.
+void FileWatcher::add (const RawEvent &e)
+{
+    if (e.kind == FileEvent::RENAMED) {
+        // Changes to the old name no longer matter.
+        std::map<std::string, RawEvent>::iterator old = pending.find(e.oldPath);
+        bool old_created = old != pending.end() && old->second.kind == FileEvent::CREATED;
+        if (old != pending.end()) pending.erase(old);
+        if (old_created) {
+            // Created and renamed within the interval, so just created.
+            RawEvent c = e;
+            c.kind = FileEvent::CREATED;
+            c.oldPath.clear();
+            pending[e.path] = c;
+            return;
+        }
+    }
+
+    std::map<std::string, RawEvent>::iterator it = pending.find(e.path);
+    if (it == pending.end()) {
+        pending[e.path] = e;
+        return;
+    }
+    RawEvent &p = it->second;
+    FileEvent::Kind was = p.kind;
+    p.time = e.time;
+    switch (e.kind) {
+        case FileEvent::CREATED:
+        // Deleted and recreated is how many editors save.
+        if (was == FileEvent::DELETED) p.kind = FileEvent::MODIFIED;
+        break;
+
+        case FileEvent::MODIFIED:
+        // Stays created or renamed.
+        if (was == FileEvent::DELETED) p.kind = FileEvent::MODIFIED;
+        break;
+
+        case FileEvent::DELETED:
+        if (was == FileEvent::CREATED) {
+            pending.erase(it);
+        } else {
+            p.kind = FileEvent::DELETED;
+            p.oldPath.clear();
+        }
+        break;
+
+        case FileEvent::RENAMED:
+        // Renamed over a file that had pending changes.
+        p.kind = FileEvent::RENAMED;
+        p.oldPath = e.oldPath;
+        break;
+    }
+}
+
+size_t FileWatcher::release (std::vector<FileEvent> &out, bool all)
+{
+    unsigned long long now = micros();
+    size_t count = 0;
+    std::map<std::string, RawEvent>::iterator it = pending.begin();
+    while (it != pending.end()) {
+        if (!all && now - it->second.time < debounce) {
+            ++it;
+            continue;
+        }
+        FileEvent e;
+        e.kind = it->second.kind;
+        e.path = it->second.path;
+        e.oldPath = it->second.oldPath;
+        out.push_back(e);
+        count++;
+        pending.erase(it++);
+    }
+    return count;
+}
+
+size_t FileWatcher::poll (std::vector<FileEvent> &out)
+{
+    std::vector<RawEvent> raw;
+    osRead(raw);
+    for (size_t i=0 ; i<raw.size() ; ++i) add(raw[i]);
+    return release(out, false);
+}
+
+size_t FileWatcher::poll (const Callback &cb)
+{
+    std::vector<FileEvent> events;
+    poll(events);
+    for (size_t i=0 ; i<events.size() ; ++i) cb(events[i]);
+    return events.size();
+}
+
+size_t FileWatcher::wait (std::vector<FileEvent> &out, unsigned long long timeout_us)
+{
+    unsigned long long start = micros();
+    size_t count = poll(out);
+    while (count == 0) {
+        unsigned long long now = micros();
+        if (now - start >= timeout_us) break;
+        unsigned long long left = timeout_us - (now - start);
+        // Wake up when the oldest pending event becomes ready.
+        for (std::map<std::string, RawEvent>::const_iterator i=pending.begin(),
+             i_=pending.end() ; i!=i_ ; ++i) {
+            unsigned long long ready = i->second.time + debounce;
+            unsigned long long until = ready > now ? ready - now : 0;
+            if (until < left) left = until;
+        }
+        osWait(left);
+        count = poll(out);
+    }
+    return count;
+}
+
+size_t FileWatcher::flush (std::vector<FileEvent> &out)
+{
+    std::vector<RawEvent> raw;
+    osRead(raw);
+    for (size_t i=0 ; i<raw.size() ; ++i) add(raw[i]);
+    return release(out, true);
+}
+
+void push_file_event (lua_State *L, const FileEvent &e)
+{
+    lua_createtable(L, 0, 3);
+    lua_pushstring(L, to_string(e.kind));
+    lua_setfield(L, -2, "kind");
+    push_string(L, e.path);
+    lua_setfield(L, -2, "path");
+    if (e.kind == FileEvent::RENAMED) {
+        push_string(L, e.oldPath);
+        lua_setfield(L, -2, "old_path");
+    }
+}
+
+size_t file_watcher_poll_lua (lua_State *L, FileWatcher &w, int queue)
+{
+    if (queue < 0 && queue > LUA_REGISTRYINDEX) queue = lua_gettop(L) + queue + 1;
+    std::vector<FileEvent> events;
+    w.poll(events);
+    int n = int(lua_objlen(L, queue));
+    for (size_t i=0 ; i<events.size() ; ++i) {
+        push_file_event(L, events[i]);
+        lua_rawseti(L, queue, ++n);
+    }
+    return events.size();
+}
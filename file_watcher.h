@@ -0,0 +1,149 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+/** A change to a file, reported by FileWatcher. */
+struct FileEvent {
+    enum Kind { CREATED, MODIFIED, DELETED, RENAMED };
+    Kind kind;
+    std::string path;       // canonical, as produced by absolute_path
+    std::string oldPath;    // for RENAMED, otherwise empty
+};
+
+const char *to_string (FileEvent::Kind k);
+
+/** Watches directory trees for changes to the files in them, for hot reload.
+ *
+ * Uses inotify on Linux, so it costs nothing while nothing changes.  Bursts
+ * of events for a file (e.g. an editor's write, truncate, write, rename) are
+ * coalesced into one, which is only reported once the file has been quiet
+ * for the debounce interval.  Directories are not reported, but new ones are
+ * watched automatically.
+ *
+ * Not thread safe.  The OS specific parts are in posix_file_watcher.cpp and
+ * win32_file_watcher.cpp.  Only Linux is supported so far, elsewhere the
+ * constructor throws an Exception.
+ */
+class FileWatcher {
+
+    public:
+
+    /** A change as reported by the OS, before coalescing. */
+    struct RawEvent {
+        FileEvent::Kind kind;
+        std::string path;
+        std::string oldPath;
+        unsigned long long time;
+    };
+
+    typedef std::function<void (const FileEvent &)> Callback;
+
+    private:
+
+    int fd;
+    const unsigned long long debounce;
+
+    struct Watch {
+        std::string dir;    // on disk
+        std::string path;   // canonical
+        std::set<std::string> files;    // names, to report if the directory goes
+    };
+    std::map<int, Watch> watches;
+
+    // Waiting for MOVED_TO, by cookie.
+    std::map<unsigned, std::string> movedFrom;
+    std::map<unsigned, std::string> movedDirFrom;
+
+    // Coalesced, waiting for the path to go quiet.
+    std::map<std::string, RawEvent> pending;
+
+    FileWatcher (const FileWatcher &) = delete;
+    FileWatcher &operator= (const FileWatcher &) = delete;
+
+    void osOpen (void);
+    void osClose (void);
+    void osAddWatch (const std::string &dir, const std::string &path);
+    void osRead (std::vector<RawEvent> &out);
+    void osForgetTree (const std::string &path, bool unwatch, unsigned long long now,
+                       std::vector<RawEvent> &out);
+    bool osWait (unsigned long long timeout_us);
+
+    void add (const RawEvent &e);
+    size_t release (std::vector<FileEvent> &out, bool all);
+
+    public:
+
+    /** \param debounce_us How long a file must be unchanged before its
+     * events are reported.  Throws an Exception if the platform has no
+     * support. */
+    FileWatcher (unsigned long long debounce_us=100000);
+    ~FileWatcher (void);
+
+    /** Watch the directory dir on disk and everything under it.  Events are
+     * reported with paths under the given canonical path, e.g.
+     * watch("/home/me/game/common", "/common").  Throws an Exception on
+     * error. */
+    void watch (const std::string &dir, const std::string &path);
+
+    /** The OS handle, to wait on it alongside other things (e.g. with poll
+     * or epoll).  Readable when there are new events. */
+    int getFd (void) const { return fd; }
+
+    /** Number of events waiting for their debounce interval. */
+    size_t getPending (void) const { return pending.size(); }
+
+    /** Append events that are ready to out, without blocking.  Returns the
+     * number appended. */
+    size_t poll (std::vector<FileEvent> &out);
+
+    /** As above, but call cb for each event. */
+    size_t poll (const Callback &cb);
+
+    /** Block until events are ready or timeout_us has passed, then poll. */
+    size_t wait (std::vector<FileEvent> &out, unsigned long long timeout_us);
+
+    /** Report all pending events now, ignoring the debounce interval. */
+    size_t flush (std::vector<FileEvent> &out);
+};
+
+/** Push a table { kind = "modified", path = "/a/b.dds" [, old_path = ...] }. */
+void push_file_event (lua_State *L, const FileEvent &e);
+
+/** Poll w and append the events as tables (see push_file_event) to the Lua
+ * table at index queue, e.g. for a coroutine that waits on the queue.
+ * Returns the number appended. */
+size_t file_watcher_poll_lua (lua_State *L, FileWatcher &w, int queue);
+
+#endif
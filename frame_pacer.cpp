@@ -0,0 +1,115 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cmath>
+
+#include "frame_pacer.h"
+#include "intrinsics.h"
+#include "sleep.h"
+
+// Bounds on how early to wake before spinning.  The lower bound covers the
+// cost of the sleep call itself.
+static const unsigned long long MIN_MARGIN_NS = 50000;
+static const unsigned long long INITIAL_MARGIN_NS = 1000000;
+
+FramePacer::FramePacer (unsigned long long period_ns)
+  : periodNs(period_ns), marginNs(INITIAL_MARGIN_NS)
+{
+    reset();
+    resetStats();
+}
+
+void FramePacer::reset (void)
+{
+    deadline = clock_nanos();
+}
+
+void FramePacer::setPeriod (unsigned long long period_ns)
+{
+    periodNs = period_ns;
+}
+
+unsigned long long FramePacer::wait (void)
+{
+    deadline += periodNs;
+    unsigned long long now = clock_nanos();
+
+    if (now >= deadline) {
+        lateCount++;
+        unsigned long long behind = now - deadline;
+        if (behind >= periodNs) deadline = now;
+        return behind;
+    }
+
+    unsigned long long max_margin = periodNs / 2;
+    unsigned long long margin = marginNs < max_margin ? marginNs : max_margin;
+    if (deadline - now > margin) {
+        unsigned long long target = deadline - margin;
+        mysleep_until(target);
+        unsigned long long woke = clock_nanos();
+        // Track the worst recent oversleep, with some headroom, and let it
+        // decay slowly so that one bad wakeup does not cost spinning forever.
+        unsigned long long oversleep = woke > target ? woke - target : 0;
+        unsigned long long want = oversleep + oversleep / 4;
+        marginNs -= marginNs / 64;
+        if (want > marginNs) marginNs = want;
+        if (marginNs < MIN_MARGIN_NS) marginNs = MIN_MARGIN_NS;
+    }
+
+    unsigned long long spin_start = clock_nanos();
+    now = spin_start;
+    while (now < deadline) {
+        CPU_PAUSE();
+        now = clock_nanos();
+    }
+
+    unsigned long long error = now - deadline;
+    waited++;
+    sumError += error;
+    sumErrorSq += double(error) * error;
+    if (error > maxError) maxError = error;
+    sumSpin += now - spin_start;
+    return error;
+}
+
+FramePacer::Stats FramePacer::getStats (void) const
+{
+    Stats s;
+    s.frames = waited + lateCount;
+    s.late = lateCount;
+    s.meanErrorNs = waited > 0 ? sumError / waited : 0;
+    double var = waited > 0 ? sumErrorSq / waited - s.meanErrorNs * s.meanErrorNs : 0;
+    s.stddevErrorNs = var > 0 ? std::sqrt(var) : 0;
+    s.maxErrorNs = maxError;
+    s.meanSpinNs = waited > 0 ? sumSpin / waited : 0;
+    s.marginNs = marginNs;
+    return s;
+}
+
+void FramePacer::resetStats (void)
+{
+    waited = 0;
+    lateCount = 0;
+    maxError = 0;
+    sumError = 0;
+    sumErrorSq = 0;
+    sumSpin = 0;
+}
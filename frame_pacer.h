@@ -0,0 +1,78 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+/** Waits for fixed-rate deadlines (a frame limiter or server tick) more
+ * precisely than sleeping alone.
+ *
+ * Each wait sleeps until shortly before the deadline, then spins for the
+ * rest.  How early to wake is calibrated from how late the OS has been
+ * waking us up, so the spin stays short on a quiet system and grows when the
+ * scheduler is sloppy.
+ *
+ * Deadlines are absolute, so time spent between waits does not accumulate
+ * as drift.  If a frame overruns by more than a whole period, the schedule
+ * restarts from now rather than running several frames back to back.
+ */
+class FramePacer {
+
+    unsigned long long periodNs;
+    unsigned long long deadline;
+    unsigned long long marginNs;
+
+    public:
+
+    /** Accumulated since construction or resetStats(). */
+    struct Stats {
+        unsigned long long frames;
+        unsigned long long late;         // frames that overran their deadline
+        double meanErrorNs;              // wakeup error of frames that waited
+        double stddevErrorNs;
+        unsigned long long maxErrorNs;
+        double meanSpinNs;               // CPU spent spinning per frame
+        unsigned long long marginNs;     // current sleep margin
+    };
+
+    /** \param period_ns The time between deadlines, e.g. 1e9/60. */
+    FramePacer (unsigned long long period_ns);
+
+    /** Wait until the next deadline.  Returns the number of nanoseconds
+     * that it woke after the deadline. */
+    unsigned long long wait (void);
+
+    /** Restart the schedule from now, e.g. after a load screen. */
+    void reset (void);
+
+    void setPeriod (unsigned long long period_ns);
+    unsigned long long getPeriod (void) const { return periodNs; }
+
+    Stats getStats (void) const;
+    void resetStats (void);
+
+    private:
+
+    unsigned long long waited, lateCount, maxError;
+    double sumError, sumErrorSq, sumSpin;
+};
+
+#endif
@@ -1,16 +1,50 @@
 UTIL_CPP_SRCS= \
+	archive.cpp \
+	async_read.cpp \
 	colour_conversion.cpp \
+	compress.cpp \
 	console.cpp \
+	cycle_clock.cpp \
+	file_watcher.cpp \
+	frame_pacer.cpp \
+	hash.cpp \
 	io_util.cpp \
+	logger.cpp \
+	lua_bytecode_cache.cpp \
+	lua_gc_driver.cpp \
+	lua_heap_census.cpp \
+	lua_serialise.cpp \
 	lua_stack.cpp \
 	lua_utf8.cpp \
 	lua_util.cpp \
+	lua_watchdog.cpp \
+	path_atom.cpp \
+	posix_async_read.cpp \
+	posix_file_watcher.cpp \
+	posix_io_util.cpp \
 	posix_sleep.cpp \
+	profiler.cpp \
+	serialise.cpp \
+	timer_wheel.cpp \
 	unicode_util.cpp \
 
 UTIL_INCLUDE_DIRS= \
 	. \
 
 UTIL_LDLIBS= \
+	-lpthread \
 	-lrt \
 
+# Packs a directory into an archive (see archive.h), links with UTIL_CPP_SRCS.
+GRIT_PACK_CPP_SRCS= \
+	grit_pack.cpp \
+
+# Times absolute_path against the old implementation over a corpus of asset
+# paths, links with UTIL_CPP_SRCS.
+PATH_BENCH_CPP_SRCS= \
+	path_bench.cpp \
+
+# Measures serialise.h throughput in MB/s, links with UTIL_CPP_SRCS.
+SERIALISE_BENCH_CPP_SRCS= \
+	serialise_bench.cpp \
+
@@ -0,0 +1,93 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Packs a directory tree into an archive, for shipping one file in place of
+// many loose ones.  Usage: grit_pack <archive> <directory>
+// The entry for <directory>/a/b.dds is /a/b.dds.
+
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "archive.h"
+#include "console.h"
+
+static void list_files (const std::string &dir, const std::string &path,
+                        std::vector<std::string> &out)
+{
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL) {
+        EXCEPT << dir << ": " << std::string(strerror(errno)) << std::endl;
+    }
+    std::vector<std::string> names;
+    while (struct dirent *ent = readdir(d)) {
+        std::string name = ent->d_name;
+        if (name == "." || name == "..") continue;
+        names.push_back(name);
+    }
+    closedir(d);
+    // So that archives of the same tree are identical.
+    std::sort(names.begin(), names.end());
+    for (size_t i=0 ; i<names.size() ; ++i) {
+        std::string child = dir + "/" + names[i];
+        struct stat st;
+        if (stat(child.c_str(), &st) != 0) {
+            EXCEPT << child << ": " << std::string(strerror(errno)) << std::endl;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            list_files(child, path + "/" + names[i], out);
+        } else if (S_ISREG(st.st_mode)) {
+            out.push_back(path + "/" + names[i]);
+        }
+    }
+}
+
+int main (int argc, char **argv)
+{
+    if (argc != 3) {
+        CERR << "Usage: " << argv[0] << " <archive> <directory>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::string archive = argv[1];
+    std::string root = argv[2];
+    try {
+        std::vector<std::string> paths;
+        list_files(root, "", paths);
+        ArchiveWriter writer(archive);
+        for (size_t i=0 ; i<paths.size() ; ++i) {
+            writer.addFile(paths[i], root + paths[i]);
+        }
+        writer.finish();
+        CLOG << archive << ": " << paths.size() << " files" << std::endl;
+    } catch (const Exception &e) {
+        CERR << e << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
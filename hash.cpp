@@ -0,0 +1,306 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <thread>
+#include <vector>
+
+#include "hash.h"
+#include "io_util.h"
+#include "lua_util.h"
+
+static const unsigned long long P1 = 11400714785074694791ULL;
+static const unsigned long long P2 = 14029467366897019727ULL;
+static const unsigned long long P3 = 1609587929392839161ULL;
+static const unsigned long long P4 = 9650029242287828579ULL;
+static const unsigned long long P5 = 2870177450012600261ULL;
+
+// Seed offset for the second lane of the 128 bit hash.
+static const unsigned long long LANE2 = 0x9E3779B97F4A7C15ULL;
+
+static const size_t TREE_CHUNK = 1024 * 1024;
+
+static inline unsigned long long rotl (unsigned long long x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline unsigned long long read64 (const unsigned char *p)
+{
+    unsigned long long v;
+    memcpy(&v, p, 8);
+    return endian_little(v);
+}
+
+static inline unsigned long long read32 (const unsigned char *p)
+{
+    unsigned v;
+    memcpy(&v, p, 4);
+    return endian_little(v);
+}
+
+static inline unsigned long long xxh_round (unsigned long long acc, unsigned long long input)
+{
+    acc += input * P2;
+    acc = rotl(acc, 31);
+    return acc * P1;
+}
+
+static inline unsigned long long merge (unsigned long long acc, unsigned long long v)
+{
+    acc ^= xxh_round(0, v);
+    return acc * P1 + P4;
+}
+
+static inline unsigned long long converge (const unsigned long long *v)
+{
+    unsigned long long h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+    for (int i=0 ; i<4 ; ++i) h = merge(h, v[i]);
+    return h;
+}
+
+// The 4 independent lanes are what lets the compiler overlap the multiplies.
+static inline const unsigned char *stripes (unsigned long long *v, const unsigned char *p,
+                                            const unsigned char *end)
+{
+    while (end - p >= 32) {
+        v[0] = xxh_round(v[0], read64(p));
+        v[1] = xxh_round(v[1], read64(p + 8));
+        v[2] = xxh_round(v[2], read64(p + 16));
+        v[3] = xxh_round(v[3], read64(p + 24));
+        p += 32;
+    }
+    return p;
+}
+
+static inline void init_lanes (unsigned long long *v, unsigned long long seed)
+{
+    v[0] = seed + P1 + P2;
+    v[1] = seed + P2;
+    v[2] = seed;
+    v[3] = seed - P1;
+}
+
+// Mix in the last 0 to 31 bytes and avalanche.
+static unsigned long long finish (unsigned long long h, const unsigned char *p, size_t len)
+{
+    while (len >= 8) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl(h, 27) * P1 + P4;
+        p += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        h ^= read32(p) * P1;
+        h = rotl(h, 23) * P2 + P3;
+        p += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        h ^= *p * P5;
+        h = rotl(h, 11) * P1;
+        p++;
+        len--;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+unsigned long long hash64 (const void *data, size_t sz, unsigned long long seed)
+{
+    const unsigned char *p = static_cast<const unsigned char*>(data);
+    const unsigned char *end = p + sz;
+    unsigned long long h;
+    if (sz >= 32) {
+        unsigned long long v[4];
+        init_lanes(v, seed);
+        p = stripes(v, p, end);
+        h = converge(v);
+    } else {
+        h = seed + P5;
+    }
+    h += sz;
+    return finish(h, p, end - p);
+}
+
+Hash128 hash128 (const void *data, size_t sz, unsigned long long seed)
+{
+    // Same as two hash64 calls, but reads the data once.
+    const unsigned char *p = static_cast<const unsigned char*>(data);
+    const unsigned char *end = p + sz;
+    Hash128 r;
+    if (sz >= 32) {
+        unsigned long long a[4], b[4];
+        init_lanes(a, seed);
+        init_lanes(b, seed + LANE2);
+        while (end - p >= 32) {
+            for (int i=0 ; i<4 ; ++i) {
+                unsigned long long in = read64(p + 8*i);
+                a[i] = xxh_round(a[i], in);
+                b[i] = xxh_round(b[i], in);
+            }
+            p += 32;
+        }
+        r.lo = converge(a);
+        r.hi = converge(b);
+    } else {
+        r.lo = seed + P5;
+        r.hi = seed + LANE2 + P5;
+    }
+    r.lo = finish(r.lo + sz, p, end - p);
+    r.hi = finish(r.hi + sz, p, end - p);
+    return r;
+}
+
+std::string hash_hex (unsigned long long h)
+{
+    char buf[17];
+    sprintf(buf, "%016llx", h);
+    return buf;
+}
+
+std::string Hash128::hex (void) const
+{
+    return hash_hex(hi) + hash_hex(lo);
+}
+
+void Hasher64::reset (unsigned long long seed_)
+{
+    seed = seed_;
+    init_lanes(v, seed);
+    total = 0;
+    bufUsed = 0;
+}
+
+void Hasher64::update (const void *data, size_t sz)
+{
+    const unsigned char *p = static_cast<const unsigned char*>(data);
+    const unsigned char *end = p + sz;
+    total += sz;
+    if (bufUsed + sz < 32) {
+        memcpy(buf + bufUsed, p, sz);
+        bufUsed += sz;
+        return;
+    }
+    if (bufUsed > 0) {
+        size_t n = 32 - bufUsed;
+        memcpy(buf + bufUsed, p, n);
+        stripes(v, buf, buf + 32);
+        p += n;
+        bufUsed = 0;
+    }
+    p = stripes(v, p, end);
+    bufUsed = end - p;
+    memcpy(buf, p, bufUsed);
+}
+
+unsigned long long Hasher64::digest (void) const
+{
+    unsigned long long h = total >= 32 ? converge(v) : seed + P5;
+    h += total;
+    return finish(h, buf, bufUsed);
+}
+
+Hasher128::Hasher128 (unsigned long long seed)
+  : a(seed), b(seed + LANE2)
+{
+}
+
+void Hasher128::reset (unsigned long long seed)
+{
+    a.reset(seed);
+    b.reset(seed + LANE2);
+}
+
+Hash128 Hasher128::digest (void) const
+{
+    Hash128 r;
+    r.lo = a.digest();
+    r.hi = b.digest();
+    return r;
+}
+
+Hash128 hash128_tree (const void *data, size_t sz, unsigned threads)
+{
+    const char *p = static_cast<const char*>(data);
+    size_t n = (sz + TREE_CHUNK - 1) / TREE_CHUNK;
+    // Leaves, followed by the size so that no two inputs give the same list.
+    std::vector<unsigned long long> leaves(2 * n + 1);
+    auto work = [&](size_t first, size_t step) {
+        for (size_t i=first ; i<n ; i+=step) {
+            size_t len = std::min(TREE_CHUNK, sz - i * TREE_CHUNK);
+            Hash128 h = hash128(p + i * TREE_CHUNK, len);
+            leaves[2*i] = endian_little(h.lo);
+            leaves[2*i + 1] = endian_little(h.hi);
+        }
+    };
+    size_t step = std::max<size_t>(1, std::min<size_t>(threads, n));
+    std::vector<std::thread> pool;
+    for (size_t t=1 ; t<step ; ++t) pool.push_back(std::thread(work, t, step));
+    work(0, step);
+    for (size_t t=0 ; t<pool.size() ; ++t) pool[t].join();
+    leaves[2 * n] = endian_little((unsigned long long)sz);
+    return hash128(&leaves[0], leaves.size() * sizeof(leaves[0]));
+}
+
+Hash128 hash128_file (const std::string &filename, unsigned threads)
+{
+    MappedFile f(filename);
+    f.advise(MappedFile::ADVISE_SEQUENTIAL);
+    return hash128_tree(f.data(), f.size(), threads);
+}
+
+static int lua_hash64 (lua_State *L)
+{
+    check_args_min(L, 1);
+    check_args_max(L, 2);
+    size_t sz;
+    const char *s = luaL_checklstring(L, 1, &sz);
+    unsigned long long seed = 0;
+    if (lua_gettop(L) == 2) seed = (unsigned long long)check_int(L, 2, 0, 9007199254740992.0);
+    push_string(L, hash_hex(hash64(s, sz, seed)));
+    return 1;
+}
+
+static int lua_hash128 (lua_State *L)
+{
+    check_args(L, 1);
+    size_t sz;
+    const char *s = luaL_checklstring(L, 1, &sz);
+    push_string(L, hash128(s, sz).hex());
+    return 1;
+}
+
+void hash_lua_init (lua_State *L)
+{
+    lua_getglobal(L, "string");
+    lua_pushcfunction(L, lua_hash64);
+    lua_setfield(L, -2, "hash64");
+    lua_pushcfunction(L, lua_hash128);
+    lua_setfield(L, -2, "hash128");
+    lua_pop(L, 1);
+}
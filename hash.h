@@ -0,0 +1,128 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstdlib>
+
+#include <functional>
+#include <ostream>
+#include <string>
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+/* Fast non-cryptographic hashes, for content addressed caches, file change
+ * detection and hash tables.  Do not use them where an attacker chooses the
+ * input and a collision matters.
+ *
+ * hash64 is XXH64, so it matches other tools' xxh64sum.  hash128 combines
+ * two XXH64 lanes with different seeds.  Results do not depend on the host
+ * byte order.
+ */
+
+/** A 128 bit hash value. */
+struct Hash128 {
+    unsigned long long lo, hi;
+
+    /** 32 hex digits, hi first. */
+    std::string hex (void) const;
+
+    friend bool operator== (const Hash128 &a, const Hash128 &b) { return a.lo == b.lo && a.hi == b.hi; }
+    friend bool operator!= (const Hash128 &a, const Hash128 &b) { return !(a == b); }
+    friend bool operator< (const Hash128 &a, const Hash128 &b)
+    { return a.hi != b.hi ? a.hi < b.hi : a.lo < b.lo; }
+};
+
+inline std::ostream &operator<< (std::ostream &o, const Hash128 &h)
+{ o << h.hex(); return o; }
+
+namespace std {
+    template<> struct hash<Hash128> {
+        size_t operator() (const Hash128 &h) const { return size_t(h.lo); }
+    };
+}
+
+unsigned long long hash64 (const void *data, size_t sz, unsigned long long seed=0);
+
+Hash128 hash128 (const void *data, size_t sz, unsigned long long seed=0);
+
+/** 16 hex digits. */
+std::string hash_hex (unsigned long long h);
+
+/** Computes hash64 of data given in pieces. */
+class Hasher64 {
+    unsigned long long v[4];
+    unsigned long long seed;
+    unsigned long long total;
+    unsigned char buf[32];
+    size_t bufUsed;
+
+    public:
+
+    Hasher64 (unsigned long long seed=0) { reset(seed); }
+
+    void reset (unsigned long long seed=0);
+
+    void update (const void *data, size_t sz);
+
+    /** The hash of everything so far.  More data may be added after. */
+    unsigned long long digest (void) const;
+};
+
+/** Computes hash128 of data given in pieces. */
+class Hasher128 {
+    Hasher64 a, b;
+
+    public:
+
+    Hasher128 (unsigned long long seed=0);
+
+    void reset (unsigned long long seed=0);
+
+    void update (const void *data, size_t sz)
+    {
+        a.update(data, sz);
+        b.update(data, sz);
+    }
+
+    Hash128 digest (void) const;
+};
+
+/** Hash large data by splitting it into 1MB chunks, hashing those on the
+ * given number of threads, and hashing the list of chunk hashes.  The
+ * result does not depend on the number of threads, but differs from
+ * hash128 of the same data. */
+Hash128 hash128_tree (const void *data, size_t sz, unsigned threads=1);
+
+/** hash128_tree of the contents of a file, read through a memory mapping.
+ * Throws an Exception if the file cannot be read. */
+Hash128 hash128_file (const std::string &filename, unsigned threads=1);
+
+/** Adds string.hash64(s [, seed]) and string.hash128(s), which return hex
+ * strings because Lua numbers cannot hold 64 bits. */
+void hash_lua_init (lua_State *L);
+
+#endif
@@ -30,4 +30,15 @@
 #define NORETURN2
 #endif
 
+/** Hint to the CPU that this is a spin-wait loop, which saves power and frees
+ * resources for the other hyperthread. */
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define CPU_PAUSE() _mm_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define CPU_PAUSE() __asm__ __volatile__ ("yield")
+#else
+#define CPU_PAUSE() do { } while (0)
+#endif
+
 #endif
@@ -33,63 +33,382 @@
 InFile::InFile (const std::string &filename)
   : filename(filename)
 {
-    in.open(filename);
+    in.open(filename, std::ios::binary);
     if (!in.good()) {
         EXCEPT<<filename<<": "<<std::string(strerror(errno))<<std::endl;
     }
 }
 
+size_t InFile::read_some (void *data, size_t sz)
+{
+    in.read((char*)data, sz);
+    if (in.bad()) {
+        EXCEPT<<filename<<": "<<std::string(strerror(errno))<<std::endl;
+    }
+    return in.gcount();
+}
+
+unsigned long long InFile::remaining (void)
+{
+    std::streampos here = in.tellg();
+    in.seekg(0, std::ios::end);
+    std::streampos end = in.tellg();
+    in.seekg(here);
+    if (here < 0 || end < 0 || !in.good()) {
+        EXCEPT<<filename<<": "<<std::string(strerror(errno))<<std::endl;
+    }
+    return (unsigned long long)(end - here);
+}
+
+BufferedInFile::BufferedInFile (const std::string &filename, Endianness endian,
+                                size_t buffer_size)
+  : source(NULL), buf(buffer_size), pos(0), end(0), bufOffset(0),
+    swap(endian != endian_native()), filename(filename)
+{
+    f = fopen(filename.c_str(), "rb");
+    if (f == NULL) {
+        EXCEPT<<filename<<": "<<std::string(strerror(errno))<<std::endl;
+    }
+    // We do our own buffering.
+    setvbuf(f, NULL, _IONBF, 0);
+}
+
+BufferedInFile::BufferedInFile (InSource &source, const std::string &name,
+                                Endianness endian, size_t buffer_size)
+  : f(NULL), source(&source), buf(buffer_size), pos(0), end(0), bufOffset(0),
+    swap(endian != endian_native()), filename(name)
+{
+}
+
+BufferedInFile::~BufferedInFile (void)
+{
+    if (f != NULL) fclose(f);
+}
+
+size_t BufferedInFile::readSome (void *data, size_t sz)
+{
+    if (source != NULL) return source->read(data, sz);
+    size_t got = fread(data, 1, sz, f);
+    if (ferror(f)) {
+        EXCEPT<<filename<<": offset "<<bufOffset<<": "<<std::string(strerror(errno))<<std::endl;
+    }
+    return got;
+}
+
+void BufferedInFile::refill (void)
+{
+    bufOffset += end;
+    pos = 0;
+    end = readSome(&buf[0], buf.size());
+}
+
+void BufferedInFile::seek (unsigned long long offset)
+{
+    if (offset >= bufOffset && offset <= bufOffset + end) {
+        pos = offset - bufOffset;
+        return;
+    }
+    if (source != NULL) {
+        source->seek(offset);
+        bufOffset = offset;
+        pos = end = 0;
+        return;
+    }
+#ifdef WIN32
+    if (_fseeki64(f, offset, SEEK_SET) != 0) {
+#else
+    if (fseeko(f, offset, SEEK_SET) != 0) {
+#endif
+        EXCEPT<<filename<<": offset "<<offset<<": "<<std::string(strerror(errno))<<std::endl;
+    }
+    bufOffset = offset;
+    pos = end = 0;
+}
+
+bool BufferedInFile::atEnd (void)
+{
+    if (pos < end) return false;
+    refill();
+    return end == 0;
+}
+
+void BufferedInFile::read_bytes (void *data, size_t sz)
+{
+    char *dest = static_cast<char*>(data);
+    while (sz > 0) {
+        if (pos == end) {
+            if (sz >= buf.size()) {
+                // Large reads go straight to the destination.
+                bufOffset += end;
+                pos = end = 0;
+                size_t got = readSome(dest, sz);
+                bufOffset += got;
+                if (got < sz) {
+                    EXCEPT<<filename<<": offset "<<bufOffset<<": Unexpected end of file"<<std::endl;
+                }
+                return;
+            }
+            refill();
+            if (end == 0) {
+                EXCEPT<<filename<<": offset "<<tell()<<": Unexpected end of file"<<std::endl;
+            }
+        }
+        size_t n = std::min(sz, end - pos);
+        memcpy(dest, &buf[pos], n);
+        pos += n;
+        dest += n;
+        sz -= n;
+    }
+}
+
 OutFile::OutFile (const std::string &filename)
   : filename(filename)
 {
-    out.open(filename);
+    out.open(filename, std::ios::binary);
     if (!out.good()) {
         EXCEPT<<filename<<": "<<std::string(strerror(errno))<<std::endl;
     }
 }
 
-static std::string collapse_path (const std::string &path)
+BufferedOutFile::BufferedOutFile (const std::string &filename, Endianness endian,
+                                  bool background, size_t buffer_size)
+  : handle(-1), sink(NULL), front(buffer_size), used(0), handed(0),
+    swap(endian != endian_native()), background(background), backUsed(0), backBusy(false),
+    quit(false), failed(false), reported(false), filename(filename)
 {
-    // first split into dirs
-    std::vector<std::string> dirs;
-    std::string next;
-    for (unsigned i=0 ; i<path.length() ; ++i) {
-        if (path[i] == '/') {
-            dirs.push_back(next);
-            next.clear();
+    osOpen();
+    if (background) {
+        back.resize(buffer_size);
+        flusher = std::thread(&BufferedOutFile::flusherMain, this);
+    }
+}
+
+BufferedOutFile::BufferedOutFile (OutSink &sink, const std::string &name, Endianness endian,
+                                  bool background, size_t buffer_size)
+  : handle(-1), sink(&sink), front(buffer_size), used(0), handed(0),
+    swap(endian != endian_native()), background(background), backUsed(0), backBusy(false),
+    quit(false), failed(false), reported(false), filename(name)
+{
+    if (background) {
+        back.resize(buffer_size);
+        flusher = std::thread(&BufferedOutFile::flusherMain, this);
+    }
+}
+
+BufferedOutFile::~BufferedOutFile (void)
+{
+    drain();
+    if (background) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        cond.notify_all();
+        flusher.join();
+    }
+    if (sink == NULL) osClose();
+    if (failed && !reported) {
+        CERR << filename << ": " << error << std::endl;
+    }
+}
+
+void BufferedOutFile::flusherMain (void)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cond.wait(lock, [this]{ return backBusy || quit; });
+        if (backBusy) {
+            lock.unlock();
+            // Once a write has failed, writing more would leave a hole.
+            if (!failed) {
+                Span<const char> buf(&back[0], backUsed);
+                std::string msg = writeOut(&buf, 1);
+                if (!msg.empty()) setError(msg);
+            }
+            lock.lock();
+            backBusy = false;
+            cond.notify_all();
         } else {
-            next += path[i];
+            return;
         }
     }
-    dirs.push_back(next);
+}
 
-    std::vector<std::string> dirs2;
-    // process ..
-    for (unsigned i=0 ; i<dirs.size() ; ++i) {
-        const std::string &d = dirs[i];
-        if (d == ".") {
-            continue;
-        } else if (d == "..") {
-            if (dirs2.size() == 0)
-                EXCEPT << "Invalid path: " << path << ENDL;
-            dirs2.pop_back();
-        } else if (d == "") {
+void BufferedOutFile::setError (const std::string &msg)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (failed) return;
+    error = msg;
+    failed = true;
+}
+
+void BufferedOutFile::checkError (void)
+{
+    if (!failed) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    reported = true;
+    EXCEPT << filename << ": " << error << ENDL;
+}
+
+void BufferedOutFile::handOff (void)
+{
+    if (used == 0) return;
+    if (background) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this]{ return !backBusy; });
+        std::swap(front, back);
+        backUsed = used;
+        backBusy = true;
+        cond.notify_all();
+    } else if (!failed) {
+        Span<const char> buf(&front[0], used);
+        std::string msg = writeOut(&buf, 1);
+        if (!msg.empty()) setError(msg);
+    }
+    handed += used;
+    used = 0;
+}
+
+void BufferedOutFile::drain (void)
+{
+    handOff();
+    if (background) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this]{ return !backBusy; });
+    }
+}
+
+std::string BufferedOutFile::writeOut (const Span<const char> *bufs, size_t n)
+{
+    if (sink != NULL) return sink->write(bufs, n);
+    return osWrite(bufs, n);
+}
+
+void BufferedOutFile::writeSlow (const char *data, size_t sz)
+{
+    while (sz > 0) {
+        size_t n = std::min(sz, front.size() - used);
+        memcpy(&front[used], data, n);
+        used += n;
+        data += n;
+        sz -= n;
+        if (used == front.size()) handOff();
+    }
+    checkError();
+}
+
+void BufferedOutFile::writev (const Span<const char> *bufs, size_t n)
+{
+    size_t total = 0;
+    for (size_t i=0 ; i<n ; ++i) total += bufs[i].size();
+    if (total <= front.size() - used) {
+        for (size_t i=0 ; i<n ; ++i) {
+            if (bufs[i].empty()) continue;
+            memcpy(&front[used], bufs[i].data(), bufs[i].size());
+            used += bufs[i].size();
+        }
+        return;
+    }
+    // Too big to buffer, so write the buffer and the arrays together.  The
+    // flusher must be idle so that it does not write concurrently with us.
+    if (background) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this]{ return !backBusy; });
+    }
+    if (!failed) {
+        std::vector<Span<const char> > all;
+        all.reserve(n + 1);
+        if (used > 0) all.push_back(Span<const char>(&front[0], used));
+        all.insert(all.end(), bufs, bufs + n);
+        std::string msg = writeOut(&all[0], all.size());
+        if (!msg.empty()) setError(msg);
+    }
+    handed += used + total;
+    used = 0;
+    checkError();
+}
+
+void BufferedOutFile::flush (void)
+{
+    drain();
+    checkError();
+}
+
+void BufferedOutFile::sync (void)
+{
+    flush();
+    std::string msg = sink != NULL ? sink->sync() : osSync();
+    if (!msg.empty()) setError(msg);
+    checkError();
+}
+
+// Returns false if the path goes above the root.
+static bool normalise_path_ok (const char *a, size_t a_len, const char *b, size_t b_len,
+                               std::string &out)
+{
+    size_t len = a_len + b_len;
+    out.clear();
+    out.reserve(len + 1);
+
+    // Each component is appended to out with a leading '/', then inspected
+    // once complete, at which point it is either kept or dropped again.
+    size_t mark = 0;
+    out.push_back('/');
+    for (size_t i=0 ; i<=len ; ++i) {
+        char c = i < a_len ? a[i] : i < len ? b[i - a_len] : '/';
+        if (c != '/') {
+            out.push_back(c);
             continue;
-        } else {
-            dirs2.push_back(d);
+        }
+        size_t comp_len = out.size() - mark - 1;
+        const char *comp = out.data() + mark + 1;
+        if (comp_len == 0 || (comp_len == 1 && comp[0] == '.')) {
+            out.resize(mark);
+        } else if (comp_len == 2 && comp[0] == '.' && comp[1] == '.') {
+            out.resize(mark);
+            if (out.empty()) return false;
+            out.resize(out.rfind('/'));
+        }
+        if (i < len) {
+            mark = out.size();
+            out.push_back('/');
         }
     }
+    return true;
+}
 
-    std::stringstream ss;
-    for (unsigned i=0 ; i<dirs2.size() ; ++i) {
-        ss << "/" + dirs2[i];
+void normalise_path (const char *a, size_t a_len, const char *b, size_t b_len, std::string &out)
+{
+    if (!normalise_path_ok(a, a_len, b, b_len, out))
+        EXCEPT << "Invalid path: " << std::string(a, a_len) << std::string(b, b_len) << ENDL;
+}
+
+void absolute_path (const std::string &dir, const std::string &rel, std::string &out)
+{
+    APP_ASSERT(dir[0] == '/');
+    if (rel[0] == '/') {
+        normalise_path(rel.data(), rel.length(), NULL, 0, out);
+    } else {
+        normalise_path(dir.data(), dir.length(), rel.data(), rel.length(), out);
     }
-    return ss.str();
 }
 
-std::string absolute_path (const std::string &dir, const std::string &rel)
+Expected<std::string> try_absolute_path (const std::string &dir, const std::string &rel)
 {
     APP_ASSERT(dir[0] == '/');
-    if (rel[0] == '/') return collapse_path(rel);
-    return collapse_path(dir + rel);
+    std::string out;
+    bool ok = rel[0] == '/'
+            ? normalise_path_ok(rel.data(), rel.length(), NULL, 0, out)
+            : normalise_path_ok(dir.data(), dir.length(), rel.data(), rel.length(), out);
+    if (!ok) {
+        return Unexpected("Invalid path: " + (rel[0] == '/' ? rel : dir + rel));
+    }
+    return out;
+}
+
+std::string absolute_path (const std::string &dir, const std::string &rel)
+{
+    std::string r;
+    absolute_path(dir, rel, r);
+    return r;
 }
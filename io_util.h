@@ -26,27 +26,62 @@
 #include <cstdio>
 #include <cstring>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "exception.h"
+#include "span.h"
 
+/** Normalise the path formed by concatenating a and b (either may be empty)
+ * into out, in one pass.  Empty and "." components are dropped and ".."
+ * removes the previous component.  The result has a leading '/' but no
+ * trailing '/', and is empty for the root.  Throws an Exception if ".." would
+ * go above the root.  Does not allocate if out already has enough capacity.
+ * The output must not alias the inputs. */
+void normalise_path (const char *a, size_t a_len, const char *b, size_t b_len, std::string &out);
+
+/** Resolve rel against the absolute directory dir (rel may also be absolute)
+ * and normalise the result. */
 std::string absolute_path (const std::string &dir, const std::string &rel);
 
+/** As above, but writes into out, so a buffer can be reused across calls. */
+void absolute_path (const std::string &dir, const std::string &rel, std::string &out);
+
+/** As above, but returns the error instead of throwing it, for callers that
+ * are testing paths that may well be invalid. */
+Expected<std::string> try_absolute_path (const std::string &dir, const std::string &rel);
+
 class InFile {
     std::ifstream in;
     public:
     const std::string filename;
     InFile (const std::string &filename);
     ~InFile (void) { in.close(); }
-    template<class T> void read (T &v)
+    /** Read exactly sz bytes, or throw. */
+    void read_bytes (void *data, size_t sz)
     {
-        in.read((char*)&v, sizeof(v));
+        in.read((char*)data, sz);
         if (!in.good()) {
             EXCEPT<<filename<<": "<<std::string(strerror(errno))<<std::endl;
         }   
     }
+    /** Read up to sz bytes, returning fewer only at the end of the file. */
+    size_t read_some (void *data, size_t sz);
+    /** Bytes between the current position and the end of the file. */
+    unsigned long long remaining (void);
+    template<class T> void read (T &v)
+    {
+        read_bytes(&v, sizeof(v));
+    }
     template<class T> T read (void)
     {
         T v;
@@ -55,19 +90,343 @@ class InFile {
     }
 };
 
+/** Byte order of data in a file. */
+enum Endianness { ENDIAN_LITTLE, ENDIAN_BIG };
+
+/** Byte order of the machine we are running on. */
+inline Endianness endian_native (void)
+{
+    const unsigned short v = 1;
+    return *(const unsigned char*)&v == 1 ? ENDIAN_LITTLE : ENDIAN_BIG;
+}
+
+/** The byte order we are not running on. */
+inline Endianness endian_other (void)
+{
+    return endian_native() == ENDIAN_LITTLE ? ENDIAN_BIG : ENDIAN_LITTLE;
+}
+
+/** Reverse the byte order of a number or enum.  Other types need an
+ * endian_swap overload of their own (e.g. serialise.h), and calling it on
+ * one without is a compile error. */
+template<class T>
+inline typename std::enable_if<std::is_arithmetic<T>::value || std::is_enum<T>::value>::type
+endian_swap (T &v)
+{
+    char *c = reinterpret_cast<char*>(&v);
+    std::reverse(c, c + sizeof(v));
+}
+
+/** Whether endian_swap has an overload for T. */
+template<class T> struct has_endian_swap {
+    template<class U> static char test (decltype(endian_swap(std::declval<U&>())) *);
+    template<class U> static long test (...);
+    static const bool value = sizeof(test<T>(0)) == 1;
+};
+
+/** Swap if asked to.  Files are often read in their native byte order, so a
+ * type without a conversion only throws if one is actually needed. */
+template<class T>
+inline typename std::enable_if<has_endian_swap<T>::value>::type endian_swap_if (bool swap, T &v)
+{
+    if (swap) endian_swap(v);
+}
+
+template<class T>
+inline typename std::enable_if<!has_endian_swap<T>::value>::type endian_swap_if (bool swap, T &)
+{
+    if (swap) EXCEPT << "No byte order conversion defined for this type" << ENDL;
+}
+
+/** Convert between little endian (e.g. a field of a mapped file) and the
+ * host byte order.  The conversion is the same in both directions. */
+template<class T> inline T endian_little (T v)
+{
+    if (endian_native() != ENDIAN_LITTLE) endian_swap(v);
+    return v;
+}
+
+/** Where a BufferedInFile reads from instead of a file, e.g. to decompress
+ * (see compress.h). */
+class InSource {
+    public:
+    virtual ~InSource (void) { }
+
+    /** Read up to sz bytes, returning fewer only at the end.  Throws an
+     * Exception on error. */
+    virtual size_t read (void *data, size_t sz) = 0;
+
+    /** Continue reading from the given offset.  Throws an Exception if that
+     * is not possible. */
+    virtual void seek (unsigned long long offset) = 0;
+};
+
+/** Like InFile, but reads through a large buffer so that reading many small
+ * values does not cost a stream call each, and can convert the byte order.
+ * Errors report the file offset at which they occurred. */
+class BufferedInFile {
+    FILE *f;                        // NULL if reading from source
+    InSource *source;
+    std::vector<char> buf;
+    size_t pos, end;                // unread data is buf[pos, end)
+    unsigned long long bufOffset;   // file offset of buf[0]
+    bool swap;
+
+    void refill (void);
+    size_t readSome (void *data, size_t sz);
+
+    public:
+
+    const std::string filename;
+
+    /** \param endian The byte order of the data in the file. */
+    BufferedInFile (const std::string &filename, Endianness endian=endian_native(),
+                    size_t buffer_size=1024*1024);
+
+    /** Read from source, which must outlive this.  The name is only for
+     * error messages. */
+    BufferedInFile (InSource &source, const std::string &name,
+                    Endianness endian=endian_native(), size_t buffer_size=1024*1024);
+    ~BufferedInFile (void);
+
+    Endianness getEndian (void) const { return swap ? endian_other() : endian_native(); }
+    /** For formats that record their byte order in the file. */
+    void setEndian (Endianness e) { swap = e != endian_native(); }
+
+    /** File offset of the next byte to be read. */
+    unsigned long long tell (void) const { return bufOffset + pos; }
+
+    void seek (unsigned long long offset);
+
+    /** Whether the whole file has been read. */
+    bool atEnd (void);
+
+    /** Read exactly sz bytes (no byte order conversion), or throw. */
+    void read_bytes (void *data, size_t sz);
+
+    template<class T> void read (T &v)
+    {
+        if (end - pos >= sizeof(v)) {
+            memcpy(&v, &buf[pos], sizeof(v));
+            pos += sizeof(v);
+        } else {
+            read_bytes(&v, sizeof(v));
+        }
+        endian_swap_if(swap, v);
+    }
+    template<class T> T read (void)
+    {
+        T v;
+        read(v);
+        return v;
+    }
+
+    /** Fill the given array from the file, in one copy. */
+    template<class T> void read_array (Span<T> arr)
+    {
+        read_bytes(arr.data(), arr.bytes());
+        if (swap) {
+            for (size_t i=0 ; i<arr.size() ; ++i) endian_swap_if(true, arr[i]);
+        }
+    }
+};
+
+/** A whole file mapped read-only into memory, for large immutable assets.
+ * Data is read in place through typed views, without copying.  The
+ * implementation is platform specific (posix_io_util.cpp, win32_io_util.cpp).
+ */
+class MappedFile {
+    const char *base;
+    size_t len;
+
+    MappedFile (const MappedFile &) = delete;
+    MappedFile &operator= (const MappedFile &) = delete;
+
+    public:
+
+    /** Access pattern hints, see advise. */
+    enum Advice { ADVISE_NORMAL, ADVISE_SEQUENTIAL, ADVISE_RANDOM, ADVISE_WILLNEED };
+
+    const std::string filename;
+
+    /** \param populate Read the whole file in now rather than page faulting
+     * it in on first access. */
+    MappedFile (const std::string &filename, bool populate=false);
+    ~MappedFile (void);
+
+    const char *data (void) const { return base; }
+    size_t size (void) const { return len; }
+
+    /** Tell the OS how the given range will be accessed.  Only a hint, so it
+     * does nothing where unsupported. */
+    void advise (Advice advice, size_t offset=0, size_t sz=size_t(-1));
+
+    /** count values of type T at the given offset, which must be within the
+     * file and suitably aligned. */
+    template<class T> Span<const T> view (size_t offset, size_t count) const
+    {
+        if (offset > len || count > (len - offset) / sizeof(T)) {
+            EXCEPT<<filename<<": offset "<<offset<<": Cannot view "<<count
+                  <<" values of size "<<sizeof(T)<<" in a file of size "<<len<<ENDL;
+        }
+        const char *p = base + offset;
+        if (reinterpret_cast<size_t>(p) % alignof(T) != 0) {
+            EXCEPT<<filename<<": offset "<<offset<<": Not aligned to "<<alignof(T)<<ENDL;
+        }
+        return Span<const T>(reinterpret_cast<const T*>(p), count);
+    }
+};
+
 class OutFile {
     std::ofstream out;
     public:
     const std::string filename;
     OutFile (const std::string &filename);
     ~OutFile (void) { out.close(); }
-    template<class T> void write (const T &v)
+    void write_bytes (const void *data, size_t sz)
     {
-        out.write((char*)&v, sizeof(v));
+        out.write((const char*)data, sz);
         if (!out.good()) {
             EXCEPT<<filename<<": "<<std::string(strerror(errno))<<std::endl;
         }   
     }
+    template<class T> void write (const T &v)
+    {
+        write_bytes(&v, sizeof(v));
+    }
+};
+
+/** Where a BufferedOutFile writes to instead of a file, e.g. to compress
+ * (see compress.h).  With background set, it is called from the
+ * BufferedOutFile's thread. */
+class OutSink {
+    public:
+    virtual ~OutSink (void) { }
+
+    /** Write the n byte arrays in order.  Returns an error message, or the
+     * empty string on success. */
+    virtual std::string write (const Span<const char> *bufs, size_t n) = 0;
+
+    /** Wait for what was written to reach the disk, as for write. */
+    virtual std::string sync (void) = 0;
+};
+
+/** Like OutFile, but collects writes in a large buffer so that writing many
+ * small values does not cost a stream call each, and can convert the byte
+ * order.
+ *
+ * With background set, full buffers are handed to a thread that writes them
+ * while the next one fills, so the caller only waits for the disk if it
+ * produces data faster than the disk can take it.  Write errors on that
+ * thread are reported by the next flush or sync (or the next buffer hand
+ * off).  Errors in the destructor cannot be thrown so are printed to CERR;
+ * call flush first if they matter.
+ *
+ * The file operations are platform specific (posix_io_util.cpp,
+ * win32_io_util.cpp).
+ */
+class BufferedOutFile {
+    long long handle;
+    OutSink *sink;                  // NULL if writing to the file
+    std::vector<char> front;        // being filled by the caller
+    size_t used;
+    unsigned long long handed;      // bytes passed to the OS or the thread
+    bool swap;
+
+    const bool background;
+    std::thread flusher;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<char> back;         // being written by the flusher
+    size_t backUsed;
+    bool backBusy;
+    bool quit;
+    std::atomic<bool> failed;
+    std::string error;
+    bool reported;
+
+    BufferedOutFile (const BufferedOutFile &) = delete;
+    BufferedOutFile &operator= (const BufferedOutFile &) = delete;
+
+    // Implemented per platform.  The write and sync functions return an
+    // error message, or the empty string on success.
+    void osOpen (void);
+    void osClose (void);
+    std::string osWrite (const Span<const char> *bufs, size_t n);
+    std::string osSync (void);
+
+    std::string writeOut (const Span<const char> *bufs, size_t n);
+    void flusherMain (void);
+    void setError (const std::string &msg);
+    void checkError (void);
+    void handOff (void);
+    void drain (void);
+    void writeSlow (const char *data, size_t sz);
+
+    public:
+
+    const std::string filename;
+
+    /** \param endian The byte order to write the data in.
+     * \param background Write full buffers from a separate thread. */
+    BufferedOutFile (const std::string &filename, Endianness endian=endian_native(),
+                     bool background=false, size_t buffer_size=1024*1024);
+
+    /** Write to sink, which must outlive this.  The name is only for error
+     * messages. */
+    BufferedOutFile (OutSink &sink, const std::string &name, Endianness endian=endian_native(),
+                     bool background=false, size_t buffer_size=1024*1024);
+    ~BufferedOutFile (void);
+
+    Endianness getEndian (void) const { return swap ? endian_other() : endian_native(); }
+
+    /** Number of bytes written so far, including those still buffered. */
+    unsigned long long tell (void) const { return handed + used; }
+
+    /** Write sz bytes (no byte order conversion). */
+    void write_bytes (const void *data, size_t sz)
+    {
+        if (sz <= front.size() - used) {
+            memcpy(&front[used], data, sz);
+            used += sz;
+        } else {
+            writeSlow(static_cast<const char*>(data), sz);
+        }
+    }
+
+    template<class T> void write (const T &v)
+    {
+        if (swap) {
+            T tmp = v;
+            endian_swap_if(true, tmp);
+            write_bytes(&tmp, sizeof(tmp));
+        } else {
+            write_bytes(&v, sizeof(v));
+        }
+    }
+
+    /** Write the given array, in one copy if no byte order conversion is
+     * needed. */
+    template<class T> void write_array (Span<T> arr)
+    {
+        if (swap) {
+            for (size_t i=0 ; i<arr.size() ; ++i) write(arr[i]);
+        } else {
+            write_bytes(arr.data(), arr.bytes());
+        }
+    }
+
+    /** Write the n byte arrays in order.  Data that does not fit in the
+     * buffer is passed to the OS in one gathered write instead of being
+     * copied. */
+    void writev (const Span<const char> *bufs, size_t n);
+
+    /** Pass everything written so far to the OS, and throw any error that
+     * occurred since the last flush. */
+    void flush (void);
+
+    /** Like flush, but also wait for the data to reach the disk. */
+    void sync (void);
 };
 
 #endif
@@ -0,0 +1,591 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "logger.h"
+
+namespace {
+
+    // A single producer, single consumer byte ring.  Each message is a
+    // header (length, level) followed by the text, and may wrap around.
+    // head and tail count bytes ever written and read, so never wrap.
+    struct Ring {
+        std::vector<char> buf;
+        size_t mask;
+        std::atomic<unsigned long long> head;
+        std::atomic<unsigned long long> tail;
+        std::atomic<unsigned long long> dropped;
+        std::atomic<bool> dead;     // its thread has exited
+
+        Ring (size_t size)
+          : buf(size), mask(size - 1), head(0), tail(0), dropped(0), dead(false)
+        { }
+
+        size_t capacity (void) const { return buf.size(); }
+
+        void put (unsigned long long pos, const void *data, size_t len)
+        {
+            size_t off = size_t(pos & mask);
+            size_t first = std::min(len, buf.size() - off);
+            memcpy(&buf[off], data, first);
+            memcpy(&buf[0], static_cast<const char*>(data) + first, len - first);
+        }
+
+        void get (unsigned long long pos, void *data, size_t len) const
+        {
+            size_t off = size_t(pos & mask);
+            size_t first = std::min(len, buf.size() - off);
+            memcpy(data, &buf[off], first);
+            memcpy(static_cast<char*>(data) + first, &buf[0], len - first);
+        }
+    };
+
+    struct Header {
+        unsigned len;
+        unsigned level;
+    };
+
+    // Set in Header::level for a LogRecord, which is decoded by the writer.
+    const unsigned LOG_BINARY = 0x100;
+
+    void stderr_sink (LogLevel, const char *msg, size_t len)
+    {
+        // One call per line so that other writers to stderr do not split it.
+        char buf[1024];
+        if (len < sizeof buf) {
+            memcpy(buf, msg, len);
+            buf[len] = '\n';
+            fwrite(buf, 1, len + 1, stderr);
+        } else {
+            std::string line(msg, len);
+            line += '\n';
+            fwrite(line.data(), 1, line.size(), stderr);
+        }
+    }
+
+    class Logger {
+        std::mutex ringsMutex;
+        std::vector<Ring*> rings;
+
+        std::mutex sinkMutex;
+        LogSink sink;
+
+        std::mutex wakeMutex;
+        std::condition_variable wake;
+        std::atomic<bool> sleeping;
+
+        std::thread writer;
+
+        // Completed passes over all the rings, for flush.
+        std::atomic<unsigned long long> passes;
+
+        // Messages lost by rings that have since been freed.
+        std::atomic<unsigned long long> droppedTotal;
+
+        // Messages logged by the sink itself, only touched by the writer.
+        std::vector<std::pair<unsigned, std::string> > deferred;
+
+        void callSink (unsigned level, const char *msg, size_t len)
+        {
+            std::lock_guard<std::mutex> lock(sinkMutex);
+            if (level & LOG_BINARY) {
+                std::string text = log_decode(msg, len);
+                sink(LogLevel(level & ~LOG_BINARY), text.data(), text.size());
+            } else {
+                sink(LogLevel(level), msg, len);
+            }
+        }
+
+        void emit (unsigned level, const char *msg, size_t len)
+        {
+            callSink(level, msg, len);
+            // Calling the sink from inside itself would deadlock on
+            // sinkMutex, so what it logged is written once it has returned.
+            while (!deferred.empty()) {
+                std::vector<std::pair<unsigned, std::string> > now;
+                now.swap(deferred);
+                for (size_t i=0 ; i<now.size() ; ++i)
+                    callSink(now[i].first, now[i].second.data(), now[i].second.size());
+            }
+        }
+
+        // Returns whether anything was written.
+        bool drain (Ring &r, std::string &scratch)
+        {
+            unsigned long long t = r.tail.load(std::memory_order_relaxed);
+            unsigned long long h = r.head.load(std::memory_order_acquire);
+            bool any = t != h;
+            while (t != h) {
+                Header hdr;
+                r.get(t, &hdr, sizeof hdr);
+                scratch.resize(hdr.len);
+                if (hdr.len > 0) r.get(t + sizeof hdr, &scratch[0], hdr.len);
+                emit(hdr.level, scratch.data(), scratch.size());
+                t += sizeof hdr + hdr.len;
+                r.tail.store(t, std::memory_order_release);
+            }
+            unsigned long long lost = r.dropped.exchange(0);
+            if (lost > 0) {
+                droppedTotal += lost;
+                char buf[64];
+                int n = snprintf(buf, sizeof buf, "[%llu log messages dropped]", lost);
+                emit(LOG_ERROR, buf, n);
+                any = true;
+            }
+            return any;
+        }
+
+        bool drainAll (std::string &scratch)
+        {
+            bool any = false;
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            for (size_t i=0 ; i<rings.size() ; ) {
+                Ring *r = rings[i];
+                // Check before draining, so nothing is written after.
+                bool dead = r->dead.load();
+                any = drain(*r, scratch) || any;
+                if (dead) {
+                    rings[i] = rings.back();
+                    rings.pop_back();
+                    delete r;
+                } else {
+                    ++i;
+                }
+            }
+            return any;
+        }
+
+        bool pending (void)
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            for (size_t i=0 ; i<rings.size() ; ++i) {
+                if (rings[i]->head.load() != rings[i]->tail.load(std::memory_order_relaxed))
+                    return true;
+            }
+            return false;
+        }
+
+        void run (void)
+        {
+            writerThread() = true;
+            std::string scratch;
+            while (true) {
+                bool any = drainAll(scratch);
+                passes++;
+                if (any) continue;
+                std::unique_lock<std::mutex> lock(wakeMutex);
+                sleeping = true;
+                // A producer that queued before seeing sleeping has to be
+                // noticed here.
+                if (!pending()) wake.wait_for(lock, std::chrono::milliseconds(100));
+                sleeping = false;
+            }
+        }
+
+        public:
+
+        std::atomic<int> overflow;
+        std::atomic<size_t> ringSize;
+
+        Logger (void)
+          : sink(stderr_sink), sleeping(false), passes(0), droppedTotal(0),
+            overflow(LOG_OVERFLOW_DROP), ringSize(64 * 1024)
+        {
+            writer = std::thread(&Logger::run, this);
+            // The logger lives until the process exits, so the thread is
+            // never joined.  Flush at exit so that the last messages are
+            // not lost.
+            writer.detach();
+        }
+
+        static bool &writerThread (void)
+        {
+            static thread_local bool v = false;
+            return v;
+        }
+
+        Ring *addRing (void)
+        {
+            // Big enough for several LogRecords.
+            size_t sz = 4096;
+            while (sz < ringSize) sz *= 2;
+            Ring *r = new Ring(sz);
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            rings.push_back(r);
+            return r;
+        }
+
+        void setSink (const LogSink &s)
+        {
+            std::lock_guard<std::mutex> lock(sinkMutex);
+            sink = s;
+        }
+
+        void notify (void)
+        {
+            // Only the first producer to see the writer asleep pays for the
+            // wakeup.
+            if (sleeping && sleeping.exchange(false)) {
+                std::lock_guard<std::mutex> lock(wakeMutex);
+                wake.notify_one();
+            }
+        }
+
+        // For the writer thread (e.g. a sink that logs), which must not wait
+        // on itself.  emit() writes these after the sink returns.
+        void defer (unsigned level, const char *msg, size_t len)
+        {
+            deferred.push_back(std::make_pair(level, std::string(msg, len)));
+        }
+
+        void write (Ring &r, unsigned level, const char *msg, size_t len)
+        {
+            bool error = (level & ~LOG_BINARY) == LOG_ERROR;
+            // Longer text is split into several messages, so that one can
+            // always fit.  A LogRecord is much smaller than this.
+            size_t max = r.capacity() / 4 - sizeof(Header);
+            // Once part of a message is queued, wait for room for the rest.
+            bool may_drop = overflow == LOG_OVERFLOW_DROP && !error;
+            do {
+                Header hdr;
+                hdr.len = unsigned(std::min(len, max));
+                hdr.level = level;
+                size_t need = sizeof hdr + hdr.len;
+                unsigned long long h = r.head.load(std::memory_order_relaxed);
+                while (r.capacity() - (h - r.tail.load(std::memory_order_acquire)) < need) {
+                    if (may_drop) {
+                        r.dropped++;
+                        return;
+                    }
+                    notify();
+                    std::this_thread::yield();
+                }
+                r.put(h, &hdr, sizeof hdr);
+                r.put(h + sizeof hdr, msg, hdr.len);
+                r.head.store(h + need);
+                msg += hdr.len;
+                len -= hdr.len;
+                may_drop = false;
+            } while (len > 0);
+            notify();
+            // Errors often come just before an abort or a debugger trap, so
+            // do not return until they (and everything before them) are out.
+            if (error) flush();
+        }
+
+        void flush (void)
+        {
+            if (writerThread()) return;
+            // The pass in progress may have missed our messages, but the one
+            // after it will not.
+            unsigned long long want = passes + 2;
+            while (passes < want) {
+                {
+                    std::lock_guard<std::mutex> lock(wakeMutex);
+                    wake.notify_one();
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        unsigned long long dropped (void)
+        {
+            unsigned long long d = droppedTotal;
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            for (size_t i=0 ; i<rings.size() ; ++i) d += rings[i]->dropped;
+            return d;
+        }
+    };
+
+    void flush_at_exit (void);
+
+    Logger &logger (void)
+    {
+        // Never destroyed, so it can be used from static destructors.
+        static Logger *l = NULL;
+        static std::once_flag once;
+        std::call_once(once, [] {
+            l = new Logger();
+            atexit(flush_at_exit);
+        });
+        return *l;
+    }
+
+    void flush_at_exit (void)
+    {
+        logger().flush();
+    }
+
+    // Gives each thread its ring, and marks it for freeing when the thread
+    // exits.
+    struct RingOwner {
+        Ring *ring;
+        RingOwner (void) : ring(logger().addRing()) { }
+        ~RingOwner (void) { ring->dead = true; }
+    };
+
+    Ring &thread_ring (void)
+    {
+        static thread_local RingOwner owner;
+        return *owner.ring;
+    }
+
+    // Collects text up to a newline or flush, then logs it.
+    class LogBuf : public std::streambuf {
+        LogLevel level;
+        std::string line;
+
+        void emit (void)
+        {
+            log_write(level, line.data(), line.size());
+            line.clear();
+        }
+
+        protected:
+
+        std::streamsize xsputn (const char *s, std::streamsize n)
+        {
+            const char *end = s + n;
+            while (s < end) {
+                const char *nl = static_cast<const char*>(memchr(s, '\n', end - s));
+                if (nl == NULL) {
+                    line.append(s, end - s);
+                    break;
+                }
+                line.append(s, nl - s);
+                emit();
+                s = nl + 1;
+            }
+            return n;
+        }
+
+        int overflow (int c)
+        {
+            if (c == traits_type::eof()) return traits_type::not_eof(c);
+            if (c == '\n') emit();
+            else line.push_back(char(c));
+            return c;
+        }
+
+        int sync (void)
+        {
+            if (!line.empty()) emit();
+            return 0;
+        }
+
+        public:
+
+        LogBuf (LogLevel level) : level(level) { }
+    };
+
+    struct ThreadStreams {
+        LogBuf verboseBuf, infoBuf, errorBuf;
+        std::ostream verbose, info, error;
+        ThreadStreams (void)
+          : verboseBuf(LOG_VERBOSE), infoBuf(LOG_INFO), errorBuf(LOG_ERROR),
+            verbose(&verboseBuf), info(&infoBuf), error(&errorBuf)
+        { }
+    };
+
+}
+
+std::ostream &log_stream (LogLevel level)
+{
+    static thread_local ThreadStreams streams;
+    switch (level) {
+        case LOG_VERBOSE: return streams.verbose;
+        case LOG_INFO: return streams.info;
+        default: return streams.error;
+    }
+}
+
+namespace {
+
+    void write_any (unsigned level, const char *msg, size_t len)
+    {
+        // The writer thread holds ringsMutex while it calls the sink, so must
+        // not even look up its ring.
+        if (Logger::writerThread()) logger().defer(level, msg, len);
+        else logger().write(thread_ring(), level, msg, len);
+    }
+
+}
+
+void log_write (LogLevel level, const char *msg, size_t len)
+{
+    write_any(level, msg, len);
+}
+
+void log_write_binary (LogLevel level, const char *record, size_t len)
+{
+    write_any(level | LOG_BINARY, record, len);
+}
+
+namespace {
+
+    struct RecordReader {
+        const char *p, *end;
+
+        template<class T> bool get (T &v)
+        {
+            if (size_t(end - p) < sizeof v) return false;
+            memcpy(&v, p, sizeof v);
+            p += sizeof v;
+            return true;
+        }
+    };
+
+}
+
+std::string log_decode (const char *record, size_t len)
+{
+    RecordReader r = { record, record + len };
+    const char *fmt;
+    if (!r.get(fmt)) return "[bad log record]";
+
+    std::string out;
+    char buf[256];
+    while (*fmt != '\0') {
+        const char *pc = strchr(fmt, '%');
+        if (pc == NULL) {
+            out += fmt;
+            break;
+        }
+        out.append(fmt, pc - fmt);
+        if (pc[1] == '%') {
+            out += '%';
+            fmt = pc + 2;
+            continue;
+        }
+
+        // Keep flags, width and precision, drop length modifiers, and pick
+        // the length from the recorded type instead.
+        std::string spec = "%";
+        const char *q = pc + 1;
+        while (*q != '\0' && strchr("-+ #0123456789.", *q) != NULL) spec += *q++;
+        while (*q != '\0' && strchr("hlLqjzt", *q) != NULL) q++;
+        char conv = *q;
+        fmt = conv == '\0' ? q : q + 1;
+        bool want_int = conv != '\0' && strchr("diouxXc", conv) != NULL;
+        bool want_float = conv != '\0' && strchr("fFeEgGaA", conv) != NULL;
+
+        char tag;
+        if (!r.get(tag)) {
+            out += "<missing>";
+            continue;
+        }
+        long long i;
+        unsigned long long u;
+        double f;
+        const void *ptr;
+        unsigned short slen;
+        int n = 0;
+        switch (tag) {
+            case 'i':
+            if (!r.get(i)) break;
+            if (want_float) n = snprintf(buf, sizeof buf, (spec + conv).c_str(), double(i));
+            else if (conv == 'c') n = snprintf(buf, sizeof buf, (spec + conv).c_str(), int(i));
+            else if (want_int) n = snprintf(buf, sizeof buf, (spec + "ll" + conv).c_str(), i);
+            else n = snprintf(buf, sizeof buf, "%lld", i);
+            out.append(buf, std::min(size_t(n), sizeof buf - 1));
+            continue;
+
+            case 'u':
+            if (!r.get(u)) break;
+            if (want_float) n = snprintf(buf, sizeof buf, (spec + conv).c_str(), double(u));
+            else if (conv == 'c') n = snprintf(buf, sizeof buf, (spec + conv).c_str(), int(u));
+            else if (want_int) n = snprintf(buf, sizeof buf, (spec + "ll" + conv).c_str(), u);
+            else n = snprintf(buf, sizeof buf, "%llu", u);
+            out.append(buf, std::min(size_t(n), sizeof buf - 1));
+            continue;
+
+            case 'f':
+            if (!r.get(f)) break;
+            if (want_float) n = snprintf(buf, sizeof buf, (spec + conv).c_str(), f);
+            else if (want_int) n = snprintf(buf, sizeof buf, (spec + "ll" + conv).c_str(), (long long)f);
+            else n = snprintf(buf, sizeof buf, "%g", f);
+            out.append(buf, std::min(size_t(n), sizeof buf - 1));
+            continue;
+
+            case 'p':
+            if (!r.get(ptr)) break;
+            n = snprintf(buf, sizeof buf, "%p", ptr);
+            out.append(buf, std::min(size_t(n), sizeof buf - 1));
+            continue;
+
+            case 's': {
+                if (!r.get(slen)) break;
+                // May have been truncated.
+                size_t avail = std::min(size_t(slen), size_t(r.end - r.p));
+                std::string s(r.p, avail);
+                r.p += avail;
+                if (conv == 's' && spec.length() > 1) {
+                    std::vector<char> wide(s.length() + 256);
+                    n = snprintf(&wide[0], wide.size(), (spec + "s").c_str(), s.c_str());
+                    out.append(&wide[0], std::min(size_t(n), wide.size() - 1));
+                } else {
+                    out += s;
+                }
+                continue;
+            }
+        }
+        out += "<truncated>";
+        break;
+    }
+    return out;
+}
+
+void log_set_sink (const LogSink &sink)
+{
+    logger().setSink(sink);
+}
+
+void log_set_overflow (LogOverflow policy)
+{
+    logger().overflow = policy;
+}
+
+void log_set_ring_size (size_t bytes)
+{
+    logger().ringSize = bytes;
+}
+
+void log_flush (void)
+{
+    logger().flush();
+}
+
+unsigned long long log_dropped (void)
+{
+    return logger().dropped();
+}
@@ -0,0 +1,214 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <cstdlib>
+
+#include <cstring>
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+/** Severity of a log message.  CVERB, CLOG and CERR log at these levels. */
+enum LogLevel { LOG_VERBOSE = 0, LOG_INFO = 1, LOG_ERROR = 2 };
+
+/** What to do when a thread logs faster than the writer thread can keep up
+ * and its ring buffer is full. */
+enum LogOverflow {
+    LOG_OVERFLOW_DROP,  // lose the message, and report how many were lost
+    LOG_OVERFLOW_BLOCK  // wait for space
+};
+
+/* Messages below this level are compiled out entirely, including the
+ * formatting of their arguments, e.g. -DLOG_MIN_LEVEL=1 to strip CVERB. */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+/** A stream for the given level, which is usable as a statement:
+ * LOG_STREAM(LOG_INFO) << "loaded " << n << " files" << std::endl;
+ * It is an expression rather than an if, so it is safe in an unbraced if. */
+#define LOG_STREAM(level) \
+    ((level) < LOG_MIN_LEVEL) ? (void)0 : LogVoid() & log_stream(level)
+
+/** Binds looser than << but tighter than ?:, to give both branches above
+ * the type void. */
+struct LogVoid {
+    void operator& (std::ostream &) { }
+};
+
+/** The calling thread's stream for the given level.  Text is collected until
+ * a newline or flush and then queued as one message, so lines from
+ * different threads never interleave. */
+std::ostream &log_stream (LogLevel level);
+
+/** Queue a message (without trailing newline).  Does not block or take a
+ * lock unless the overflow policy is LOG_OVERFLOW_BLOCK and the calling
+ * thread's ring is full.  LOG_ERROR messages are the exception: they are
+ * never dropped, and do not return until the sink has them, as with
+ * log_flush. */
+void log_write (LogLevel level, const char *msg, size_t len);
+
+/** Binary logging: BLOG(LOG_INFO, "frame %d took %.2fms", n, ms);
+ *
+ * The calling thread only copies the format pointer and the raw argument
+ * values into its ring.  The text is produced later, on the writer thread,
+ * so this costs tens of nanoseconds instead of the microsecond or so of
+ * formatting a line through CLOG.
+ *
+ * The format must be a string literal (or otherwise live forever) and uses
+ * printf conversions, but length modifiers are ignored because the type of
+ * each argument is recorded with it.  Integers, enums, floating point,
+ * strings and pointers are supported.  Strings are copied, and the whole
+ * record is truncated at LOG_RECORD_MAX bytes.
+ */
+#define BLOG(level, ...) \
+    ((level) < LOG_MIN_LEVEL) ? (void)0 : log_binary(level, __VA_ARGS__)
+
+static const size_t LOG_RECORD_MAX = 512;
+
+/** A format pointer followed by a tagged value for each argument. */
+struct LogRecord {
+    char buf[LOG_RECORD_MAX];
+    size_t size;
+
+    LogRecord (const char *fmt) : size(0) { put(&fmt, sizeof fmt); }
+
+    void put (const void *data, size_t len)
+    {
+        if (len > LOG_RECORD_MAX - size) len = LOG_RECORD_MAX - size;
+        memcpy(buf + size, data, len);
+        size += len;
+    }
+
+    template<class T> void put (char tag, T v)
+    {
+        if (LOG_RECORD_MAX - size < 1 + sizeof v) {
+            size = LOG_RECORD_MAX;
+            return;
+        }
+        buf[size] = tag;
+        memcpy(buf + size + 1, &v, sizeof v);
+        size += 1 + sizeof v;
+    }
+
+    void putString (const char *s, size_t len)
+    {
+        if (len > 0xffff) len = 0xffff;
+        put('s', (unsigned short)len);
+        put(s, len);
+    }
+};
+
+template<class T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+log_arg (LogRecord &r, T v)
+{
+    r.put('i', (long long)v);
+}
+
+template<class T>
+typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+log_arg (LogRecord &r, T v)
+{
+    r.put('u', (unsigned long long)v);
+}
+
+template<class T>
+typename std::enable_if<std::is_enum<T>::value>::type log_arg (LogRecord &r, T v)
+{
+    r.put('i', (long long)v);
+}
+
+template<class T>
+typename std::enable_if<std::is_floating_point<T>::value>::type log_arg (LogRecord &r, T v)
+{
+    r.put('f', (double)v);
+}
+
+template<class T> void log_arg (LogRecord &r, const T *v)
+{
+    r.put('p', (const void*)v);
+}
+
+static inline void log_arg (LogRecord &r, const char *v)
+{
+    if (v == NULL) v = "(null)";
+    r.putString(v, strlen(v));
+}
+
+static inline void log_arg (LogRecord &r, const std::string &v)
+{
+    r.putString(v.data(), v.length());
+}
+
+static inline void log_args (LogRecord &)
+{
+}
+
+template<class T, class... Rest>
+void log_args (LogRecord &r, const T &v, const Rest &... rest)
+{
+    log_arg(r, v);
+    log_args(r, rest...);
+}
+
+/** Queue a record made by LogRecord and log_arg, see BLOG. */
+void log_write_binary (LogLevel level, const char *record, size_t len);
+
+template<class... Args>
+void log_binary (LogLevel level, const char *fmt, const Args &... args)
+{
+    LogRecord r(fmt);
+    log_args(r, args...);
+    log_write_binary(level, r.buf, r.size);
+}
+
+/** Format a record made by LogRecord, as the writer thread does. */
+std::string log_decode (const char *record, size_t len);
+
+/** Receives messages on the writer thread, in order for each thread.  What it
+ * logs itself is passed to it after it returns. */
+typedef std::function<void (LogLevel level, const char *msg, size_t len)> LogSink;
+
+/** Replace the sink.  The default writes each message as a line to stderr. */
+void log_set_sink (const LogSink &sink);
+
+void log_set_overflow (LogOverflow policy);
+
+/** Size of the ring buffer of threads that log for the first time after
+ * this call.  Rounded up to a power of 2, at least 4KB.  Default 64KB.  A
+ * line longer than a quarter of the ring reaches the sink as several
+ * consecutive messages. */
+void log_set_ring_size (size_t bytes);
+
+/** Wait until everything logged so far has been given to the sink, e.g.
+ * before a crash handler exits. */
+void log_flush (void);
+
+/** Total messages lost to LOG_OVERFLOW_DROP. */
+unsigned long long log_dropped (void);
+
+#endif
@@ -0,0 +1,196 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <string>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+#include "lua_bytecode_cache.h"
+
+// Bump this if the layout of the header changes.
+static const char cache_magic[4] = { 'G', 'L', 'B', 'C' };
+static const unsigned int cache_version = 2;
+
+static bool read_file (const std::string &filename, std::string &data)
+{
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (f == NULL) return false;
+    data.clear();
+    char buf[16384];
+    size_t sz;
+    while ((sz = fread(buf, 1, sizeof buf, f)) > 0)
+        data.append(buf, sz);
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+static bool write_file (const std::string &filename, const std::string &data)
+{
+    // Write to a temporary file and rename it into place, so that a reader
+    // never sees a half-written entry.
+    std::string tmp = filename + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (f == NULL) return false;
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = (fclose(f) == 0) && ok;
+    if (ok && rename(tmp.c_str(), filename.c_str()) != 0) {
+        // Windows will not rename over an existing file.
+        remove(filename.c_str());
+        ok = rename(tmp.c_str(), filename.c_str()) == 0;
+    }
+    if (!ok) remove(tmp.c_str());
+    return ok;
+}
+
+namespace {
+
+    struct CacheHeader {
+        unsigned long long mtime;
+        unsigned long long size;
+        unsigned long long hash;
+        std::string path;
+    };
+
+    struct ChunkReader {
+        const char *data;
+        size_t size;
+    };
+
+}
+
+template<class T> static void put (std::string &s, const T &v)
+{
+    s.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template<class T> static bool get (const std::string &s, size_t &pos, T &v)
+{
+    if (s.size() - pos < sizeof(v)) return false;
+    memcpy(&v, &s[pos], sizeof(v));
+    pos += sizeof(v);
+    return true;
+}
+
+static void header_put (std::string &s, const CacheHeader &h)
+{
+    s.append(cache_magic, sizeof cache_magic);
+    put(s, cache_version);
+    put(s, h.mtime);
+    put(s, h.size);
+    put(s, h.hash);
+    put(s, (unsigned int)h.path.length());
+    s.append(h.path);
+}
+
+// Returns the offset of the bytecode, or 0 if the header is unreadable.
+static size_t header_get (const std::string &s, CacheHeader &h)
+{
+    if (s.size() < sizeof cache_magic) return 0;
+    if (memcmp(s.data(), cache_magic, sizeof cache_magic)) return 0;
+    size_t pos = sizeof cache_magic;
+    unsigned int version, path_len;
+    if (!get(s, pos, version) || version != cache_version) return 0;
+    if (!get(s, pos, h.mtime)) return 0;
+    if (!get(s, pos, h.size)) return 0;
+    if (!get(s, pos, h.hash)) return 0;
+    if (!get(s, pos, path_len)) return 0;
+    if (s.size() - pos < path_len) return 0;
+    h.path.assign(s, pos, path_len);
+    return pos + path_len;
+}
+
+static const char *chunk_reader (lua_State *L, void *ud, size_t *sz)
+{
+    (void) L;
+    ChunkReader &r = *static_cast<ChunkReader*>(ud);
+    if (r.size == 0) return NULL;
+    *sz = r.size;
+    r.size = 0;
+    return r.data;
+}
+
+static int chunk_writer (lua_State *L, const void *p, size_t sz, void *ud)
+{
+    (void) L;
+    static_cast<std::string*>(ud)->append(static_cast<const char*>(p), sz);
+    return 0;
+}
+
+int lua_cached_loadfile (lua_State *L, const std::string &cache_dir,
+                         const std::string &filename, const std::string &path)
+{
+    std::string chunk_name = "@" + path;
+
+    struct stat st;
+    std::string src;
+    if (stat(filename.c_str(), &st) != 0 || !read_file(filename, src)) {
+        lua_pushfstring(L, "cannot open %s", filename.c_str());
+        return LUA_ERRFILE;
+    }
+
+    CacheHeader want;
+    want.mtime = (unsigned long long)st.st_mtime;
+    want.size = src.size();
+    want.hash = hash64(src.data(), src.size());
+    want.path = path;
+
+    char name[17];
+    sprintf(name, "%016llx", hash64(path.data(), path.size()));
+    std::string cache_file = cache_dir + "/" + name + ".luac";
+
+    std::string cached;
+    if (read_file(cache_file, cached)) {
+        CacheHeader got;
+        size_t pos = header_get(cached, got);
+        if (pos > 0 && got.mtime == want.mtime && got.size == want.size
+            && got.hash == want.hash && got.path == want.path) {
+            ChunkReader r = { cached.data() + pos, cached.size() - pos };
+            // The chunk name is stored in the bytecode, but pass it anyway.
+            // lua_load also rejects bytecode from an incompatible Lua build,
+            // in which case we fall through and recompile.
+            if (lua_load(L, chunk_reader, &r, chunk_name.c_str()) == 0) return 0;
+            lua_pop(L, 1);
+        }
+    }
+
+    // Skip a #! line the same way luaL_loadfile does, keeping the newline so
+    // that line numbers are unchanged.
+    if (src.length() > 0 && src[0] == '#') {
+        for (size_t i=0 ; i<src.length() && src[i] != '\n' ; ++i)
+            src[i] = ' ';
+    }
+
+    int status = luaL_loadbuffer(L, src.data(), src.size(), chunk_name.c_str());
+    if (status != 0) return status;
+
+    std::string entry;
+    header_put(entry, want);
+    if (lua_dump(L, chunk_writer, &entry) == 0)
+        write_file(cache_file, entry);
+
+    return 0;
+}
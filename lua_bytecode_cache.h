@@ -0,0 +1,51 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef LUA_BYTECODE_CACHE_H
+#define LUA_BYTECODE_CACHE_H
+
+#include <string>
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+/** Load a Lua source file like luaL_loadfile, but keep the compiled chunk in
+ * cache_dir so the next load can skip the compiler.
+ *
+ * Cache entries are keyed by path and validated against the mtime, size and
+ * content hash of the source file.  A stale, corrupt or incompatible entry
+ * (e.g. from a different Lua build) is silently recompiled and replaced.
+ * Failure to write the cache is not an error.
+ *
+ * \param filename The source file on disk.
+ * \param path The script path, used as the chunk name "@path" so that
+ *        lua_current_dir and traceback() see the same thing as they would
+ *        for an uncached load.
+ * \returns 0 with the function on the stack, otherwise LUA_ERRFILE,
+ *          LUA_ERRSYNTAX or LUA_ERRMEM with an error message on the stack.
+ */
+int lua_cached_loadfile (lua_State *L, const std::string &cache_dir,
+                         const std::string &filename, const std::string &path);
+
+#endif
@@ -0,0 +1,112 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "lua_gc_driver.h"
+#include "lua_util.h"
+#include "sleep.h"
+
+// Bounds on the LUA_GCSTEP argument.  Very small steps are dominated by
+// overhead, very large ones can blow the budget in a single call.
+static const int MIN_STEP_KB = 1;
+static const int MAX_STEP_KB = 1024;
+
+// Aim to fit this many steps in each frame's budget.
+static const int TARGET_STEPS = 8;
+
+LuaGCDriver::LuaGCDriver (lua_State *L, size_t memory_limit_kb)
+  : L(L), memoryLimitKB(memory_limit_kb), stepKB(16)
+{
+    size_t counter, frees;
+    lua_alloc_stats_get(counter, lastMallocs, lastReallocs, frees);
+    stats.micros = 0;
+    stats.steps = 0;
+    stats.stepKB = stepKB;
+    stats.cycles = 0;
+    stats.fullCollects = 0;
+    lua_gc(L, LUA_GCSTOP, 0);
+}
+
+LuaGCDriver::~LuaGCDriver (void)
+{
+    lua_gc(L, LUA_GCRESTART, 0);
+}
+
+void LuaGCDriver::frame (unsigned long long budget_us)
+{
+    unsigned long long start = micros();
+
+    stats.steps = 0;
+
+    size_t counter, mallocs, reallocs, frees;
+    lua_alloc_stats_get(counter, mallocs, reallocs, frees);
+    size_t allocs = (mallocs - lastMallocs) + (reallocs - lastReallocs);
+    lastMallocs = mallocs;
+    lastReallocs = reallocs;
+
+    size_t heap_kb = lua_gc(L, LUA_GCCOUNT, 0);
+
+    if (memoryLimitKB > 0 && heap_kb >= memoryLimitKB) {
+        lua_gc(L, LUA_GCCOLLECT, 0);
+        // LUA_GCCOLLECT and LUA_GCSTEP reset the threshold that LUA_GCSTOP
+        // set, which would let allocation trigger the collector again.
+        lua_gc(L, LUA_GCSTOP, 0);
+        stats.fullCollects++;
+        stats.micros = micros() - start;
+        return;
+    }
+
+    // Estimate how much was allocated since the last frame from the number of
+    // allocations and the mean size of a live block, and spread enough work to
+    // pay that back over the frame's steps.
+    if (counter > 0) {
+        size_t alloc_kb = allocs * heap_kb / counter;
+        int want = int(alloc_kb / TARGET_STEPS);
+        if (want > MAX_STEP_KB) want = MAX_STEP_KB;
+        if (want > stepKB) stepKB = want;
+    }
+
+    while (true) {
+        unsigned long long before = micros();
+        if (before - start >= budget_us) break;
+        stats.steps++;
+        bool finished = lua_gc(L, LUA_GCSTEP, stepKB) != 0;
+        unsigned long long took = micros() - before;
+        // Keep individual steps to a fraction of the budget so we do not
+        // overshoot it by much.
+        if (took * TARGET_STEPS > budget_us) {
+            stepKB /= 2;
+        } else if (took * TARGET_STEPS * 4 < budget_us) {
+            stepKB *= 2;
+        }
+        if (stepKB < MIN_STEP_KB) stepKB = MIN_STEP_KB;
+        if (stepKB > MAX_STEP_KB) stepKB = MAX_STEP_KB;
+        if (finished) {
+            // Don't start another cycle on a heap we have just swept.
+            stats.cycles++;
+            break;
+        }
+    }
+
+    lua_gc(L, LUA_GCSTOP, 0);
+
+    stats.stepKB = stepKB;
+    stats.micros = micros() - start;
+}
@@ -0,0 +1,86 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef LUA_GC_DRIVER_H
+#define LUA_GC_DRIVER_H
+
+#include <cstdlib>
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+/** Runs the Lua garbage collector in small steps within a time budget each
+ * frame, instead of letting allocation debt trigger it at arbitrary points.
+ *
+ * The step size follows the allocation rate reported by lua_alloc_stats_get,
+ * so the state must have been created with lua_alloc.  If the heap exceeds
+ * the memory limit, a full collection is done regardless of the budget.
+ *
+ * The driver owns the collector's stopped state for the lifetime of the
+ * object: every frame() leaves it stopped again (stepping restarts it in Lua
+ * 5.1), so other code should not use LUA_GCRESTART, LUA_GCSTEP or
+ * LUA_GCCOLLECT on L in the meantime.
+ */
+class LuaGCDriver {
+
+    lua_State *L;
+    size_t memoryLimitKB;
+
+    size_t lastMallocs, lastReallocs;
+    int stepKB;
+
+    public:
+
+    /** Frame statistics, for display in debug overlays. */
+    struct Stats {
+        unsigned long long micros;   // time spent in the last frame
+        int steps;                   // LUA_GCSTEP calls in the last frame
+        int stepKB;                  // step size used in the last frame
+        unsigned long cycles;        // total completed incremental cycles
+        unsigned long fullCollects;  // total memory pressure collections
+    };
+
+    /** Stops automatic collection on L.
+     * \param memory_limit_kb Heap size (per LUA_GCCOUNT) that triggers a full
+     * collection, or 0 for no limit.
+     */
+    LuaGCDriver (lua_State *L, size_t memory_limit_kb=0);
+
+    /** Restarts automatic collection. */
+    ~LuaGCDriver (void);
+
+    /** Call once per frame to do up to budget_us microseconds of collection. */
+    void frame (unsigned long long budget_us);
+
+    void setMemoryLimitKB (size_t v) { memoryLimitKB = v; }
+    size_t getMemoryLimitKB (void) const { return memoryLimitKB; }
+
+    const Stats &getStats (void) const { return stats; }
+
+    private:
+
+    Stats stats;
+};
+
+#endif
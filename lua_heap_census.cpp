@@ -0,0 +1,332 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include "console.h"
+#include "exception.h"
+#include "lua_heap_census.h"
+#include "lua_util.h"
+
+// Approximate sizes of Lua 5.1 objects on a 64 bit machine.
+static const long long STRING_BYTES = 24;
+static const long long TABLE_BYTES = 56;
+static const long long TABLE_SLOT_BYTES = 16;
+static const long long TABLE_NODE_BYTES = 40;
+static const long long CLOSURE_BYTES = 40;
+static const long long UPVALUE_BYTES = 40;
+static const long long USERDATA_BYTES = 40;
+static const long long THREAD_BYTES = 184;
+static const long long STACK_SLOT_BYTES = 16;
+
+// Tables with more string keys than this are treated as maps rather than
+// records, otherwise every map would get a shape of its own.
+static const size_t MAX_SHAPE_KEYS = 8;
+
+namespace {
+
+    class Census {
+
+        lua_State *L;
+
+        // Objects waiting to be scanned are kept in a Lua table so that they
+        // cannot be collected, and to avoid recursion on deep structures.
+        int queue;
+        int head, tail;
+
+        std::set<const void*> seen;
+
+        // Metatable -> name it was registered under with luaL_newmetatable.
+        std::map<const void*, std::string> tags;
+
+        public:
+
+        LuaHeapCensus result;
+
+        Census (lua_State *L) : L(L), head(0), tail(0)
+        {
+            lua_newtable(L);
+            queue = lua_gettop(L);
+            seen.insert(lua_topointer(L, queue));
+
+            lua_pushnil(L);
+            while (lua_next(L, LUA_REGISTRYINDEX)) {
+                if (lua_type(L, -2) == LUA_TSTRING && lua_type(L, -1) == LUA_TTABLE)
+                    tags[lua_topointer(L, -1)] = lua_tostring(L, -2);
+                lua_pop(L, 1);
+            }
+        }
+
+        ~Census (void)
+        {
+            lua_remove(L, queue);
+        }
+
+        void add (const char *type, long long bytes)
+        {
+            LuaHeapEntry &e = result.byType[type];
+            e.count++;
+            e.bytes += bytes;
+            result.total.count++;
+            result.total.bytes += bytes;
+        }
+
+        void visit (int idx)
+        {
+            switch (lua_type(L, idx)) {
+                case LUA_TSTRING: {
+                    // Strings are interned so the data pointer identifies them.
+                    if (!seen.insert(lua_tostring(L, idx)).second) return;
+                    add("string", STRING_BYTES + lua_objlen(L, idx) + 1);
+                    return;
+                }
+                case LUA_TTABLE:
+                case LUA_TFUNCTION:
+                case LUA_TUSERDATA:
+                case LUA_TTHREAD: {
+                    if (!seen.insert(lua_topointer(L, idx)).second) return;
+                    lua_pushvalue(L, idx);
+                    lua_rawseti(L, queue, ++tail);
+                    return;
+                }
+                default:
+                    // Not collectable, or nothing to count.
+                    return;
+            }
+        }
+
+        // Visit the value on the top of the stack and pop it.
+        void visitTop (void)
+        {
+            visit(lua_gettop(L));
+            lua_pop(L, 1);
+        }
+
+        void scanTable (int idx)
+        {
+            if (lua_getmetatable(L, idx)) visitTop();
+
+            long long array = lua_objlen(L, idx);
+            long long entries = 0;
+            bool record = true;
+            std::vector<std::string> keys;
+            lua_pushnil(L);
+            while (lua_next(L, idx)) {
+                int v = lua_gettop(L);
+                visit(v - 1);
+                visit(v);
+                entries++;
+                if (lua_type(L, v - 1) == LUA_TSTRING) {
+                    if (keys.size() < MAX_SHAPE_KEYS) {
+                        keys.push_back(lua_tostring(L, v - 1));
+                    } else {
+                        record = false;
+                    }
+                }
+                lua_pop(L, 1);
+            }
+
+            // The hash part is always a power of 2.
+            long long hash = entries > array ? entries - array : 0;
+            long long nodes = hash > 0 ? 1 : 0;
+            while (nodes < hash) nodes *= 2;
+            long long bytes = TABLE_BYTES + array*TABLE_SLOT_BYTES + nodes*TABLE_NODE_BYTES;
+            add("table", bytes);
+
+            std::stringstream shape;
+            if (record) {
+                std::sort(keys.begin(), keys.end());
+                shape << keys;
+            } else {
+                shape << "map";
+            }
+            if (array > 0) shape << " + array";
+            LuaHeapEntry &e = result.byShape[shape.str()];
+            e.count++;
+            e.bytes += bytes;
+        }
+
+        void scanFunction (int idx)
+        {
+            bool c = lua_iscfunction(L, idx) != 0;
+            int ups = 0;
+            while (lua_getupvalue(L, idx, ups + 1) != NULL) {
+                visitTop();
+                ups++;
+            }
+            lua_getfenv(L, idx);
+            visitTop();
+            add("function", CLOSURE_BYTES + ups * (c ? STACK_SLOT_BYTES : 8 + UPVALUE_BYTES));
+        }
+
+        void scanUserdata (int idx)
+        {
+            std::string tag = "?";
+            if (lua_getmetatable(L, idx)) {
+                std::map<const void*, std::string>::iterator i = tags.find(lua_topointer(L, -1));
+                if (i != tags.end()) tag = i->second;
+                visitTop();
+            }
+            lua_getfenv(L, idx);
+            visitTop();
+            long long bytes = USERDATA_BYTES + lua_objlen(L, idx);
+            add("userdata", bytes);
+            LuaHeapEntry &e = result.byTag[tag];
+            e.count++;
+            e.bytes += bytes;
+        }
+
+        void scanThread (int idx)
+        {
+            lua_State *T = lua_tothread(L, idx);
+            // Our own stack only has the census' temporaries on it.
+            int n = T == L ? 0 : lua_gettop(T);
+            if (n > 0 && !lua_checkstack(T, 1)) n = 0;
+            for (int i=1 ; i<=n ; ++i) {
+                lua_pushvalue(T, i);
+                lua_xmove(T, L, 1);
+                visitTop();
+            }
+            add("thread", THREAD_BYTES + n*STACK_SLOT_BYTES);
+        }
+
+        void run (void)
+        {
+            while (head < tail) {
+                lua_rawgeti(L, queue, ++head);
+                lua_pushnil(L);
+                lua_rawseti(L, queue, head);
+                int idx = lua_gettop(L);
+                switch (lua_type(L, idx)) {
+                    case LUA_TTABLE: scanTable(idx); break;
+                    case LUA_TFUNCTION: scanFunction(idx); break;
+                    case LUA_TUSERDATA: scanUserdata(idx); break;
+                    case LUA_TTHREAD: scanThread(idx); break;
+                }
+                lua_pop(L, 1);
+            }
+        }
+    };
+
+}
+
+std::ostream &operator<< (std::ostream &o, const LuaHeapEntry &e)
+{
+    o << e.count << " objects, " << e.bytes << " bytes";
+    return o;
+}
+
+LuaHeapCensus lua_heap_census (lua_State *L)
+{
+    STACK_BASE;
+    check_stack(L, 10);
+    LuaHeapCensus r;
+    {
+        Census c(L);
+        c.visit(LUA_REGISTRYINDEX);
+        c.visit(LUA_GLOBALSINDEX);
+        c.run();
+        r = c.result;
+    }
+    STACK_CHECK;
+    return r;
+}
+
+static void diff_group (std::map<std::string, LuaHeapEntry> &r,
+                        const std::map<std::string, LuaHeapEntry> &before,
+                        const std::map<std::string, LuaHeapEntry> &after)
+{
+    typedef std::map<std::string, LuaHeapEntry>::const_iterator I;
+    for (I i=after.begin(), i_=after.end() ; i!=i_ ; ++i) {
+        LuaHeapEntry &e = r[i->first];
+        e.count += i->second.count;
+        e.bytes += i->second.bytes;
+    }
+    for (I i=before.begin(), i_=before.end() ; i!=i_ ; ++i) {
+        LuaHeapEntry &e = r[i->first];
+        e.count -= i->second.count;
+        e.bytes -= i->second.bytes;
+    }
+    for (std::map<std::string, LuaHeapEntry>::iterator i=r.begin() ; i!=r.end() ; ) {
+        if (i->second.count == 0 && i->second.bytes == 0) {
+            r.erase(i++);
+        } else {
+            ++i;
+        }
+    }
+}
+
+LuaHeapCensus lua_heap_census_diff (const LuaHeapCensus &before, const LuaHeapCensus &after)
+{
+    LuaHeapCensus r;
+    r.total.count = after.total.count - before.total.count;
+    r.total.bytes = after.total.bytes - before.total.bytes;
+    diff_group(r.byType, before.byType, after.byType);
+    diff_group(r.byTag, before.byTag, after.byTag);
+    diff_group(r.byShape, before.byShape, after.byShape);
+    return r;
+}
+
+static bool bigger (const std::pair<std::string, LuaHeapEntry> &a,
+                    const std::pair<std::string, LuaHeapEntry> &b)
+{
+    return llabs(a.second.bytes) > llabs(b.second.bytes);
+}
+
+static void print_group (std::ostream &o, const std::map<std::string, LuaHeapEntry> &group)
+{
+    std::vector<std::pair<std::string, LuaHeapEntry> > sorted(group.begin(), group.end());
+    std::stable_sort(sorted.begin(), sorted.end(), bigger);
+    for (size_t i=0 ; i<sorted.size() ; ++i) {
+        o << "    " << sorted[i].first << ": " << sorted[i].second << "\n";
+    }
+}
+
+std::ostream &operator<< (std::ostream &o, const LuaHeapCensus &c)
+{
+    o << "Lua heap: " << c.total << "\n";
+    o << "By type: " << c.byType << "\n";
+    o << "By userdata tag:\n";
+    print_group(o, c.byTag);
+    o << "By table shape:\n";
+    print_group(o, c.byShape);
+    return o;
+}
+
+void lua_heap_census_dump (const LuaHeapCensus &c, const std::string &filename)
+{
+    std::ofstream out(filename.c_str());
+    if (!out.good()) {
+        EXCEPT << filename << ": " << std::string(strerror(errno)) << ENDL;
+    }
+    out << c;
+    if (!out.good()) {
+        EXCEPT << filename << ": " << std::string(strerror(errno)) << ENDL;
+    }
+}
@@ -0,0 +1,71 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef LUA_HEAP_CENSUS_H
+#define LUA_HEAP_CENSUS_H
+
+#include <map>
+#include <ostream>
+#include <string>
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+/** Number and approximate size in bytes of a group of Lua objects.  Signed so
+ * that the difference between two censuses can be represented. */
+struct LuaHeapEntry {
+    long long count;
+    long long bytes;
+    LuaHeapEntry (void) : count(0), bytes(0) { }
+};
+
+std::ostream &operator<< (std::ostream &o, const LuaHeapEntry &e);
+
+/** The objects reachable from the registry and globals of a Lua state, grouped
+ * by type, by userdata tag (the name it was registered under with
+ * luaL_newmetatable) and by table shape (its sorted string keys and whether it
+ * has an array part).  Sizes are estimates based on the Lua 5.1 object layout
+ * and do not include function prototypes. */
+struct LuaHeapCensus {
+    LuaHeapEntry total;
+    std::map<std::string, LuaHeapEntry> byType;
+    std::map<std::string, LuaHeapEntry> byTag;
+    std::map<std::string, LuaHeapEntry> byShape;
+};
+
+/** Walk the heap of L.  This touches every reachable object so it takes time
+ * proportional to the size of the heap, but it does not allocate Lua memory
+ * other than a work queue. */
+LuaHeapCensus lua_heap_census (lua_State *L);
+
+/** Return after - before, omitting groups that did not change. */
+LuaHeapCensus lua_heap_census_diff (const LuaHeapCensus &before, const LuaHeapCensus &after);
+
+/** Print the census, largest groups first, e.g. CLOG << census. */
+std::ostream &operator<< (std::ostream &o, const LuaHeapCensus &c);
+
+/** Write the census to a file, overwriting it. */
+void lua_heap_census_dump (const LuaHeapCensus &c, const std::string &filename);
+
+#endif
@@ -0,0 +1,474 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cmath>
+#include <cstring>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "exception.h"
+#include "lua_serialise.h"
+#include "lua_util.h"
+
+// Stream layout: the magic and version, then one value.  Each value is a tag
+// byte followed by its payload.  Lengths, counts and indexes are varints.
+static const char serialise_magic[4] = { 'G', 'L', 'S', 'V' };
+static const unsigned char serialise_version = 1;
+
+enum {
+    TAG_NIL,
+    TAG_FALSE,
+    TAG_TRUE,
+    TAG_INT,        // zig-zag varint, for numbers that are exact integers
+    TAG_NUMBER,     // 8 byte double
+    TAG_STRING,     // length, bytes; gets the next string index
+    TAG_STRING_REF, // string index
+    TAG_TABLE,      // array count, hash count, array values, hash keys and values
+    TAG_TABLE_REF,  // table index
+    TAG_VECTOR3,    // 3 floats
+    TAG_QUAT        // 4 floats
+};
+
+// Flush to the file in chunks of this size.
+static const size_t BUFFER_SIZE = 64*1024;
+
+// Guards the C stack against absurdly deep tables.
+static const int MAX_DEPTH = 1000;
+
+// Integers beyond this lose precision as doubles anyway.
+static const double MAX_INT = 9007199254740992.0;
+
+namespace {
+
+    class Writer {
+        std::string &buf;
+        OutFile *file;
+        public:
+        Writer (std::string &buf, OutFile *file) : buf(buf), file(file) { }
+        void bytes (const void *data, size_t sz)
+        {
+            buf.append(static_cast<const char*>(data), sz);
+        }
+        void byte (unsigned char v) { buf.push_back(v); }
+        template<class T> void pod (const T &v) { bytes(&v, sizeof v); }
+        void varint (unsigned long long v)
+        {
+            while (v >= 0x80) {
+                buf.push_back(char(v | 0x80));
+                v >>= 7;
+            }
+            buf.push_back(char(v));
+        }
+        // Write out the buffer if it has grown large enough.
+        void spill (void)
+        {
+            if (buf.size() >= BUFFER_SIZE) flush();
+        }
+        void flush (void)
+        {
+            if (file == NULL || buf.empty()) return;
+            file->write_bytes(buf.data(), buf.size());
+            buf.clear();
+        }
+    };
+
+    class Reader {
+        std::vector<char> buf;
+        const char *pos, *end;
+        InFile *file;
+        unsigned long long fileLeft;    // not yet read into buf
+
+        // Make sure n bytes are available at pos.
+        void need (size_t n)
+        {
+            if (size_t(end - pos) >= n) return;
+            if (file == NULL) EXCEPT << "Serialised data truncated" << ENDL;
+            size_t have = end - pos;
+            std::vector<char> next(std::max(n, BUFFER_SIZE));
+            if (have > 0) memcpy(&next[0], pos, have);
+            while (have < n) {
+                size_t got = file->read_some(&next[have], next.size() - have);
+                if (got == 0) EXCEPT << file->filename << ": Serialised data truncated" << ENDL;
+                have += got;
+                fileLeft -= std::min<unsigned long long>(got, fileLeft);
+            }
+            buf.swap(next);
+            pos = &buf[0];
+            end = pos + have;
+        }
+
+        public:
+
+        Reader (const char *data, size_t sz)
+          : pos(data), end(data + sz), file(NULL), fileLeft(0)
+        { }
+        Reader (InFile *file)
+          : pos(NULL), end(NULL), file(file), fileLeft(file->remaining())
+        { }
+
+        /** Bytes left in the input, to bound counts read from it. */
+        unsigned long long remaining (void) const
+        {
+            return (end - pos) + fileLeft;
+        }
+
+        void bytes (void *data, size_t sz)
+        {
+            need(sz);
+            memcpy(data, pos, sz);
+            pos += sz;
+        }
+        // Returns a pointer into the buffer, valid until the next read.
+        const char *view (size_t sz)
+        {
+            need(sz);
+            const char *r = pos;
+            pos += sz;
+            return r;
+        }
+        unsigned char byte (void)
+        {
+            need(1);
+            return *pos++;
+        }
+        template<class T> T pod (void) { T v; bytes(&v, sizeof v); return v; }
+        unsigned long long varint (void)
+        {
+            unsigned long long v = 0;
+            for (int shift=0 ; shift<64 ; shift+=7) {
+                unsigned char b = byte();
+                v |= (unsigned long long)(b & 0x7f) << shift;
+                if (!(b & 0x80)) return v;
+            }
+            EXCEPT << "Serialised data corrupt: bad varint" << ENDL;
+        }
+    };
+
+    class Serialiser {
+        lua_State *L;
+        Writer &w;
+        std::unordered_map<const void*, unsigned long> tables;
+        std::unordered_map<const char*, unsigned long> strings;
+        public:
+
+        Serialiser (lua_State *L, Writer &w) : L(L), w(w) { }
+
+        void value (int idx, int depth)
+        {
+            switch (lua_type(L, idx)) {
+                case LUA_TNIL:
+                w.byte(TAG_NIL);
+                break;
+
+                case LUA_TBOOLEAN:
+                w.byte(lua_toboolean(L, idx) ? TAG_TRUE : TAG_FALSE);
+                break;
+
+                case LUA_TNUMBER: {
+                    double n = lua_tonumber(L, idx);
+                    if (n == floor(n) && fabs(n) <= MAX_INT && !(n == 0 && std::signbit(n))) {
+                        long long i = (long long)n;
+                        w.byte(TAG_INT);
+                        w.varint(((unsigned long long)i << 1) ^ (unsigned long long)(i >> 63));
+                    } else {
+                        w.byte(TAG_NUMBER);
+                        w.pod(n);
+                    }
+                } break;
+
+                case LUA_TSTRING: {
+                    size_t len;
+                    // Lua interns strings, so equal strings share this pointer.
+                    const char *s = lua_tolstring(L, idx, &len);
+                    std::unordered_map<const char*, unsigned long>::iterator i = strings.find(s);
+                    if (i != strings.end()) {
+                        w.byte(TAG_STRING_REF);
+                        w.varint(i->second);
+                    } else {
+                        unsigned long id = strings.size();
+                        strings[s] = id;
+                        w.byte(TAG_STRING);
+                        w.varint(len);
+                        w.bytes(s, len);
+                    }
+                } break;
+
+                case LUA_TVECTOR3: {
+                    Vector3 v = check_v3(L, idx);
+                    w.byte(TAG_VECTOR3);
+                    w.pod(v.x); w.pod(v.y); w.pod(v.z);
+                } break;
+
+                case LUA_TQUAT: {
+                    Quaternion q = check_quat(L, idx);
+                    w.byte(TAG_QUAT);
+                    w.pod(q.w); w.pod(q.x); w.pod(q.y); w.pod(q.z);
+                } break;
+
+                case LUA_TTABLE:
+                table(idx, depth);
+                break;
+
+                default:
+                EXCEPT << "Cannot serialise a " << type_name(L, idx) << ENDL;
+            }
+        }
+
+        void table (int idx, int depth)
+        {
+            const void *p = lua_topointer(L, idx);
+            std::unordered_map<const void*, unsigned long>::iterator i = tables.find(p);
+            if (i != tables.end()) {
+                w.byte(TAG_TABLE_REF);
+                w.varint(i->second);
+                return;
+            }
+            if (depth >= MAX_DEPTH) EXCEPT << "Cannot serialise: tables nested too deeply" << ENDL;
+            if (!lua_checkstack(L, 3)) EXCEPT << "Cannot serialise: out of Lua stack" << ENDL;
+            unsigned long id = tables.size();
+            tables[p] = id;
+
+            unsigned long long entries = 0;
+            lua_pushnil(L);
+            while (lua_next(L, idx)) {
+                entries++;
+                lua_pop(L, 1);
+            }
+            unsigned long long array = 0;
+            while (true) {
+                lua_rawgeti(L, idx, int(array + 1));
+                bool nil = lua_isnil(L, -1);
+                lua_pop(L, 1);
+                if (nil) break;
+                array++;
+            }
+
+            w.byte(TAG_TABLE);
+            w.varint(array);
+            w.varint(entries - array);
+            for (unsigned long long i=1 ; i<=array ; ++i) {
+                lua_rawgeti(L, idx, int(i));
+                value(lua_gettop(L), depth + 1);
+                lua_pop(L, 1);
+                w.spill();
+            }
+            lua_pushnil(L);
+            while (lua_next(L, idx)) {
+                int v = lua_gettop(L);
+                if (lua_type(L, v - 1) == LUA_TNUMBER) {
+                    double k = lua_tonumber(L, v - 1);
+                    if (k >= 1 && k <= array && k == floor(k)) {
+                        lua_pop(L, 1);
+                        continue;
+                    }
+                }
+                value(v - 1, depth + 1);
+                value(v, depth + 1);
+                lua_pop(L, 1);
+                w.spill();
+            }
+        }
+    };
+
+    class Deserialiser {
+        lua_State *L;
+        Reader &r;
+        int tables, strings;
+        unsigned long numTables, numStrings;
+        public:
+
+        // Uses two stack slots to remember tables and strings by index.
+        Deserialiser (lua_State *L, Reader &r)
+          : L(L), r(r), numTables(0), numStrings(0)
+        {
+            lua_newtable(L);
+            tables = lua_gettop(L);
+            lua_newtable(L);
+            strings = lua_gettop(L);
+        }
+
+        ~Deserialiser (void)
+        {
+            lua_remove(L, strings);
+            lua_remove(L, tables);
+        }
+
+        void ref (int list, unsigned long count)
+        {
+            unsigned long long id = r.varint();
+            if (id >= count) EXCEPT << "Serialised data corrupt: bad reference" << ENDL;
+            lua_rawgeti(L, list, int(id + 1));
+        }
+
+        void value (int depth)
+        {
+            unsigned char tag = r.byte();
+            switch (tag) {
+                case TAG_NIL: lua_pushnil(L); break;
+                case TAG_FALSE: lua_pushboolean(L, 0); break;
+                case TAG_TRUE: lua_pushboolean(L, 1); break;
+
+                case TAG_INT: {
+                    unsigned long long u = r.varint();
+                    long long i = (long long)(u >> 1) ^ -(long long)(u & 1);
+                    lua_pushnumber(L, lua_Number(i));
+                } break;
+
+                case TAG_NUMBER:
+                lua_pushnumber(L, r.pod<double>());
+                break;
+
+                case TAG_STRING: {
+                    unsigned long long len = r.varint();
+                    // Before the buffer is grown to hold it.
+                    if (len > r.remaining())
+                        EXCEPT << "Serialised data corrupt: bad string length" << ENDL;
+                    const char *s = r.view(size_t(len));
+                    lua_pushlstring(L, s, len);
+                    lua_pushvalue(L, -1);
+                    lua_rawseti(L, strings, ++numStrings);
+                } break;
+
+                case TAG_STRING_REF:
+                ref(strings, numStrings);
+                break;
+
+                case TAG_VECTOR3: {
+                    float x = r.pod<float>(), y = r.pod<float>(), z = r.pod<float>();
+                    push_v3(L, Vector3(x, y, z));
+                } break;
+
+                case TAG_QUAT: {
+                    float w = r.pod<float>(), x = r.pod<float>();
+                    float y = r.pod<float>(), z = r.pod<float>();
+                    push_quat(L, Quaternion(w, x, y, z));
+                } break;
+
+                case TAG_TABLE:
+                table(depth);
+                break;
+
+                case TAG_TABLE_REF:
+                ref(tables, numTables);
+                break;
+
+                default:
+                EXCEPT << "Serialised data corrupt: bad tag " << int(tag) << ENDL;
+            }
+        }
+
+        void table (int depth)
+        {
+            if (depth >= MAX_DEPTH) EXCEPT << "Serialised data corrupt: tables nested too deeply" << ENDL;
+            if (!lua_checkstack(L, 3)) EXCEPT << "Cannot deserialise: out of Lua stack" << ENDL;
+            unsigned long long array = r.varint();
+            unsigned long long hash = r.varint();
+            // Every value takes at least a byte, so corrupt counts are caught
+            // here rather than by lua_createtable failing to allocate them.
+            unsigned long long left = r.remaining();
+            if (array > 0x7fffffff || hash > 0x7fffffff || array > left || hash > left / 2)
+                EXCEPT << "Serialised data corrupt: bad table size" << ENDL;
+            lua_createtable(L, int(array), int(hash));
+            int t = lua_gettop(L);
+            // Register before reading the contents, which may refer back to it.
+            lua_pushvalue(L, t);
+            lua_rawseti(L, tables, ++numTables);
+            for (unsigned long long i=1 ; i<=array ; ++i) {
+                value(depth + 1);
+                lua_rawseti(L, t, int(i));
+            }
+            for (unsigned long long i=0 ; i<hash ; ++i) {
+                value(depth + 1);
+                if (lua_isnil(L, -1)) EXCEPT << "Serialised data corrupt: nil key" << ENDL;
+                // lua_rawset would raise a Lua error for this.
+                if (lua_type(L, -1) == LUA_TNUMBER && lua_tonumber(L, -1) != lua_tonumber(L, -1))
+                    EXCEPT << "Serialised data corrupt: NaN key" << ENDL;
+                value(depth + 1);
+                lua_rawset(L, t);
+            }
+        }
+    };
+
+}
+
+static void serialise (lua_State *L, int index, Writer &w)
+{
+    if (index < 0 && index > LUA_REGISTRYINDEX) index = lua_gettop(L) + index + 1;
+    int top = lua_gettop(L);
+    w.bytes(serialise_magic, sizeof serialise_magic);
+    w.byte(serialise_version);
+    try {
+        Serialiser(L, w).value(index, 0);
+    } catch (const Exception &e) {
+        lua_settop(L, top);
+        throw;
+    }
+    w.flush();
+}
+
+void lua_serialise (lua_State *L, int index, OutFile &out)
+{
+    std::string buf;
+    Writer w(buf, &out);
+    serialise(L, index, w);
+}
+
+void lua_serialise (lua_State *L, int index, std::string &out)
+{
+    Writer w(out, NULL);
+    serialise(L, index, w);
+}
+
+static void deserialise (lua_State *L, Reader &r)
+{
+    char magic[sizeof serialise_magic];
+    r.bytes(magic, sizeof magic);
+    if (memcmp(magic, serialise_magic, sizeof magic))
+        EXCEPT << "Not serialised Lua data" << ENDL;
+    unsigned char version = r.byte();
+    if (version != serialise_version)
+        EXCEPT << "Unsupported serialised data version: " << int(version) << ENDL;
+    check_stack(L, 5);
+    int top = lua_gettop(L);
+    try {
+        // The deserialiser removes its tables when it goes out of scope,
+        // leaving only the value.
+        Deserialiser(L, r).value(0);
+    } catch (const Exception &e) {
+        lua_settop(L, top);
+        throw;
+    }
+}
+
+void lua_deserialise (lua_State *L, InFile &in)
+{
+    Reader r(&in);
+    deserialise(L, r);
+}
+
+void lua_deserialise (lua_State *L, const char *data, size_t sz)
+{
+    Reader r(data, sz);
+    deserialise(L, r);
+}
@@ -0,0 +1,55 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef LUA_SERIALISE_H
+#define LUA_SERIALISE_H
+
+#include <string>
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+#include "io_util.h"
+
+/** Write the value at the given stack index in a compact binary form.
+ *
+ * Supports nil, booleans, numbers, strings, Vector3, Quaternion and tables of
+ * those.  Tables referenced more than once (including cycles) are written once
+ * and then referred to by index, as are repeated strings.  Anything else
+ * (functions, userdata, threads) throws an Exception.  Numbers and floats are
+ * written in host byte order.
+ */
+void lua_serialise (lua_State *L, int index, OutFile &out);
+
+/** As above, but append the data to a string. */
+void lua_serialise (lua_State *L, int index, std::string &out);
+
+/** Read a value written by lua_serialise and push it.  Throws an Exception if
+ * the data is malformed, leaving the stack as it was. */
+void lua_deserialise (lua_State *L, InFile &in);
+
+/** As above, but from memory. */
+void lua_deserialise (lua_State *L, const char *data, size_t sz);
+
+#endif
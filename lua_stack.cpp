@@ -21,18 +21,53 @@
 
 #include <cstring>
 #include <iostream>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "console.h"
 #include "lua_stack.h"
 
-std::string lua_current_dir (lua_State *L, int level)
+namespace {
+    struct ChunkDir {
+        // The pointer used as the key can be reused by a later chunk once the
+        // original is collected, so keep the source to check it.
+        std::string source;
+        const std::string *dir;
+    };
+}
+
+static const std::string root_dir = "/";
+
+// Interned directories, never freed.  Node based so references are stable.
+static std::unordered_set<std::string> dirs;
+
+// Chunk source (as given by lua_getinfo) -> directory.
+static std::unordered_map<const char*, ChunkDir> chunk_dirs;
+
+// Forget chunks if there are more than this, to bound memory use when code is
+// generated at runtime.  The directories themselves stay interned.
+static const size_t MAX_CHUNKS = 4096;
+
+static const std::string &intern_dir (const char *source)
+{
+    // Skip the '@'.
+    const char *filename = source + 1;
+    const char *last = strrchr(filename, '/');
+    if (last == NULL) {
+        //  Must be a lua file in the root directory.
+        return root_dir;
+    }
+    return *dirs.insert(std::string(filename, last+1)).first;
+}
+
+const std::string &lua_current_dir_interned (lua_State *L, int level)
 {
     lua_Debug dbg;
     for ( ; ; level++) {
         int r = lua_getstack(L, level, &dbg);
         if (r != 1) {
             // off the bottom of the stack
-            return "/";
+            return root_dir;
         }
         r = lua_getinfo(L, "S", &dbg);
         //CVERB << dbg.what << std::endl;
@@ -46,13 +81,19 @@ std::string lua_current_dir (lua_State *L, int level)
             // Didn't come from a file.
             continue;
         }
-        std::string filename = &dbg.source[1];
-        size_t last = filename.rfind('/');
-        if (last == std::string::npos) {
-            //  Must be a lua file in the root directory.
-            return "/";
+        std::unordered_map<const char*, ChunkDir>::iterator it = chunk_dirs.find(dbg.source);
+        if (it != chunk_dirs.end() && it->second.source == dbg.source) {
+            return *it->second.dir;
         }
-        std::string dir(filename, 0, last+1);
-        return dir;
+        if (chunk_dirs.size() >= MAX_CHUNKS) chunk_dirs.clear();
+        ChunkDir &cd = chunk_dirs[dbg.source];
+        cd.source = dbg.source;
+        cd.dir = &intern_dir(dbg.source);
+        return *cd.dir;
     }
 }
+
+std::string lua_current_dir (lua_State *L, int level)
+{
+    return lua_current_dir_interned(L, level);
+}
@@ -30,6 +30,14 @@ extern "C" {
 #include <lualib.h>
 }
 
+/** The directory of the Lua file executing at the given stack level or below,
+ * with a trailing '/', or "/" if there is none. */
 std::string lua_current_dir (lua_State *L, int level=0);
 
+/** As lua_current_dir, but returns an interned copy of the directory that
+ * stays valid for the life of the program, so nothing is allocated or copied.
+ * The directory is remembered per chunk, so repeated calls from the same file
+ * cost one hash lookup.  Not thread safe, like the Lua state itself. */
+const std::string &lua_current_dir_interned (lua_State *L, int level=0);
+
 #endif
@@ -0,0 +1,134 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "lua_util.h"
+#include "lua_watchdog.h"
+#include "sleep.h"
+
+namespace {
+    struct Watchdog {
+        unsigned long long instructions;
+        unsigned long long maxInstructions;
+        unsigned long long deadline;
+        int interval;
+        lua_Hook oldHook;
+        int oldMask;
+        int oldCount;
+    };
+}
+
+// States may run on different threads.
+static std::mutex watchdogs_mutex;
+
+static std::map<lua_State*, Watchdog> watchdogs;
+
+// Every thread of a Lua state shares its registry, so this identifies the
+// state.  Lists the threads with a watchdog, most recently armed last.
+static std::map<const void*, std::vector<lua_State*> > armed;
+
+static const void *state_key (lua_State *L)
+{
+    return lua_topointer(L, LUA_REGISTRYINDEX);
+}
+
+static void watchdog_hook (lua_State *L, lua_Debug *ar)
+{
+    (void) ar;
+    unsigned long long over_instructions = 0;
+    bool over_time = false;
+    {
+        std::lock_guard<std::mutex> lock(watchdogs_mutex);
+        std::map<lua_State*, Watchdog>::iterator it = watchdogs.find(L);
+        int count = lua_gethookcount(L);
+        if (it == watchdogs.end()) {
+            // A coroutine created while the hook was set inherits it, so
+            // charge it to the budget armed last in its state, e.g. the
+            // call that resumed it.
+            std::map<const void*, std::vector<lua_State*> >::iterator a = armed.find(state_key(L));
+            if (a == armed.end()) {
+                // The budget has ended, so stop paying for the hook.
+                lua_sethook(L, NULL, 0, 0);
+                return;
+            }
+            it = watchdogs.find(a->second.back());
+        }
+        Watchdog &w = it->second;
+
+        w.instructions += count;
+        if (w.maxInstructions > 0 && w.instructions > w.maxInstructions)
+            over_instructions = w.maxInstructions;
+        else if (w.deadline > 0 && micros() > w.deadline)
+            over_time = true;
+    }
+    // Not under the lock, as the error does not return.
+    if (over_instructions > 0) {
+        std::stringstream ss;
+        ss << "Script exceeded its budget of " << over_instructions << " instructions";
+        // Level 0 because a hook runs in the frame of the interrupted function.
+        my_lua_error(L, ss.str(), 0);
+    }
+    if (over_time) {
+        my_lua_error(L, "Script exceeded its time budget", 0);
+    }
+}
+
+void lua_watchdog_begin (lua_State *L, unsigned long long max_instructions,
+                         unsigned long long max_micros, int interval)
+{
+    std::lock_guard<std::mutex> lock(watchdogs_mutex);
+    bool rearm = watchdogs.find(L) != watchdogs.end();
+    Watchdog &w = watchdogs[L];
+    std::vector<lua_State*> &threads = armed[state_key(L)];
+    if (!rearm) {
+        w.oldHook = lua_gethook(L);
+        w.oldMask = lua_gethookmask(L);
+        w.oldCount = lua_gethookcount(L);
+    } else {
+        threads.erase(std::find(threads.begin(), threads.end(), L));
+    }
+    threads.push_back(L);
+    w.instructions = 0;
+    w.maxInstructions = max_instructions;
+    w.deadline = max_micros > 0 ? micros() + max_micros : 0;
+    w.interval = interval;
+    lua_sethook(L, watchdog_hook, LUA_MASKCOUNT, interval);
+}
+
+void lua_watchdog_end (lua_State *L)
+{
+    std::lock_guard<std::mutex> lock(watchdogs_mutex);
+    std::map<lua_State*, Watchdog>::iterator it = watchdogs.find(L);
+    if (it == watchdogs.end()) return;
+    Watchdog &w = it->second;
+    lua_sethook(L, w.oldHook, w.oldMask, w.oldCount);
+    watchdogs.erase(it);
+
+    std::map<const void*, std::vector<lua_State*> >::iterator a = armed.find(state_key(L));
+    std::vector<lua_State*> &threads = a->second;
+    threads.erase(std::find(threads.begin(), threads.end(), L));
+    if (threads.empty()) armed.erase(a);
+}
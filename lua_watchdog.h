@@ -0,0 +1,64 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef LUA_WATCHDOG_H
+#define LUA_WATCHDOG_H
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+/** Arm a watchdog on the given Lua thread (the main state or a coroutine),
+ * which raises a Lua error via my_lua_error once the thread has executed more
+ * than max_instructions VM instructions or more than max_micros microseconds
+ * have passed since this call.  Either limit may be 0 to disable it.
+ *
+ * The check is done from a count hook every interval instructions, so the
+ * limits are only enforced to that granularity, and the cost is one
+ * micros() call per interval.  Hooks are per thread, so to give a
+ * coroutine a budget of its own, arm it on the coroutine before lua_resume.
+ * Coroutines created by the script inherit the hook, and are charged to the
+ * watchdog armed most recently in the same Lua state.  Any hook already
+ * installed on the thread is replaced until lua_watchdog_end.  Lua states
+ * may be used on different threads.
+ */
+void lua_watchdog_begin (lua_State *L, unsigned long long max_instructions,
+                         unsigned long long max_micros, int interval=1000);
+
+/** Disarm the watchdog and restore whatever hook was there before. */
+void lua_watchdog_end (lua_State *L);
+
+/** Scoped version of the above, for per-call budgets around lua_pcall. */
+class LuaWatchdog {
+    lua_State *L;
+    public:
+    LuaWatchdog (lua_State *L, unsigned long long max_instructions,
+                 unsigned long long max_micros, int interval=1000)
+      : L(L)
+    {
+        lua_watchdog_begin(L, max_instructions, max_micros, interval);
+    }
+    ~LuaWatchdog (void) { lua_watchdog_end(L); }
+};
+
+#endif
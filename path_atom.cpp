@@ -0,0 +1,154 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "exception.h"
+#include "io_util.h"
+#include "path_atom.h"
+
+// The table is split into shards, each with its own lock, so that threads
+// looking up different paths rarely contend.
+static const unsigned SHARDS = 16;
+
+// Id -> string is a two level array, so it never moves and can be read
+// without locking.  That is safe because an id can only be obtained by
+// interning, which publishes the string under a lock first.
+static const uint32_t CHUNK_SIZE = 4096;
+static const uint32_t MAX_CHUNKS = 4096;
+
+namespace {
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, uint32_t> atoms;
+        // dir id -> rel -> atom id
+        std::unordered_map<uint32_t, std::unordered_map<std::string, uint32_t> > resolved;
+    };
+
+    struct Table {
+        Shard shards[SHARDS];
+        std::mutex appendMutex;
+        uint32_t count;
+        const std::string **chunks[MAX_CHUNKS];
+
+        Table (void) : count(0)
+        {
+            for (uint32_t i=0 ; i<MAX_CHUNKS ; ++i) chunks[i] = NULL;
+        }
+
+        uint32_t append (const std::string *s)
+        {
+            std::lock_guard<std::mutex> lock(appendMutex);
+            uint32_t id = count;
+            uint32_t chunk = id / CHUNK_SIZE;
+            if (chunk >= MAX_CHUNKS) EXCEPT << "Too many paths interned" << ENDL;
+            if (chunks[chunk] == NULL) chunks[chunk] = new const std::string*[CHUNK_SIZE];
+            chunks[chunk][id % CHUNK_SIZE] = s;
+            count++;
+            return id;
+        }
+
+        const std::string &get (uint32_t id)
+        {
+            return *chunks[id / CHUNK_SIZE][id % CHUNK_SIZE];
+        }
+
+        uint32_t intern (const std::string &canonical)
+        {
+            Shard &shard = shards[std::hash<std::string>()(canonical) % SHARDS];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            std::unordered_map<std::string, uint32_t>::iterator i = shard.atoms.find(canonical);
+            if (i != shard.atoms.end()) return i->second;
+            // Map nodes do not move, so the key can be the stored string.
+            i = shard.atoms.insert(std::make_pair(canonical, uint32_t(0))).first;
+            i->second = append(&i->first);
+            return i->second;
+        }
+    };
+
+}
+
+static Table *make_table (void)
+{
+    Table *t = new Table();
+    // Id 0 is the root, for the default constructor.
+    t->intern("");
+    return t;
+}
+
+// Leaked deliberately, so atoms stay valid during static destruction.
+static Table &table (void)
+{
+    static Table *t = make_table();
+    return *t;
+}
+
+const std::string &PathAtom::str (void) const
+{
+    return table().get(id);
+}
+
+PathAtom path_intern (const std::string &path)
+{
+    std::string canonical;
+    normalise_path(path.data(), path.length(), NULL, 0, canonical);
+    return PathAtom(table().intern(canonical));
+}
+
+PathAtom path_resolve (PathAtom dir, const std::string &rel)
+{
+    Table &t = table();
+    Shard &shard = t.shards[(std::hash<std::string>()(rel) ^ dir.id) % SHARDS];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        std::unordered_map<uint32_t, std::unordered_map<std::string, uint32_t> >::iterator
+            d = shard.resolved.find(dir.id);
+        if (d != shard.resolved.end()) {
+            std::unordered_map<std::string, uint32_t>::iterator r = d->second.find(rel);
+            if (r != d->second.end()) return PathAtom(r->second);
+        }
+    }
+
+    std::string canonical;
+    if (rel[0] == '/') {
+        normalise_path(rel.data(), rel.length(), NULL, 0, canonical);
+    } else {
+        std::string dir_slash = dir.str() + "/";
+        normalise_path(dir_slash.data(), dir_slash.length(), rel.data(), rel.length(), canonical);
+    }
+    uint32_t id = t.intern(canonical);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.resolved[dir.id][rel] = id;
+    return PathAtom(id);
+}
+
+void path_resolve_cache_clear (void)
+{
+    Table &t = table();
+    for (unsigned i=0 ; i<SHARDS ; ++i) {
+        std::lock_guard<std::mutex> lock(t.shards[i].mutex);
+        t.shards[i].resolved.clear();
+    }
+}
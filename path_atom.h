@@ -0,0 +1,81 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef PATH_ATOM_H
+#define PATH_ATOM_H
+
+#include <cstdlib>
+#include <stdint.h>
+
+#include <functional>
+#include <ostream>
+#include <string>
+
+/** A canonical absolute path (as produced by absolute_path), stored once in a
+ * global table and referred to by a 32 bit id.  Copying, comparison and
+ * hashing are O(1).  Atoms are never freed.
+ *
+ * The ordering is by id, i.e. by when the path was first interned, not
+ * alphabetical.
+ */
+class PathAtom {
+    uint32_t id;
+    explicit PathAtom (uint32_t id) : id(id) { }
+    friend PathAtom path_intern (const std::string &path);
+    friend PathAtom path_resolve (PathAtom dir, const std::string &rel);
+    public:
+
+    /** The root directory, whose canonical form is the empty string. */
+    PathAtom (void) : id(0) { }
+
+    uint32_t getId (void) const { return id; }
+
+    /** The canonical path.  The reference is valid forever. */
+    const std::string &str (void) const;
+
+    friend bool operator== (PathAtom a, PathAtom b) { return a.id == b.id; }
+    friend bool operator!= (PathAtom a, PathAtom b) { return a.id != b.id; }
+    friend bool operator< (PathAtom a, PathAtom b) { return a.id < b.id; }
+};
+
+inline std::ostream &operator<< (std::ostream &o, PathAtom a)
+{ o << a.str(); return o; }
+
+namespace std {
+    template<> struct hash<PathAtom> {
+        size_t operator() (PathAtom a) const { return a.getId(); }
+    };
+}
+
+/** Normalise the path (see normalise_path) and return its atom.  Throws an
+ * Exception if the path is invalid.  Thread safe. */
+PathAtom path_intern (const std::string &path);
+
+/** Equivalent to path_intern(absolute_path(dir.str() + "/", rel)), but the
+ * result is remembered, so resolving the same relative path against the same
+ * directory again is two hash lookups and allocates nothing.  Thread safe. */
+PathAtom path_resolve (PathAtom dir, const std::string &rel);
+
+/** Forget remembered resolutions, e.g. after a level is unloaded.  The atoms
+ * themselves remain valid. */
+void path_resolve_cache_clear (void);
+
+#endif
@@ -0,0 +1,193 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Measures absolute_path over a corpus of asset paths, against the old
+// implementation that split into vectors and joined with a stringstream.
+// Usage: path_bench [<file>]
+// Each line of the file is "<dir> <rel>", e.g. "/vehicles/scarman/ ../common/a.dds".
+// Without a file, a corpus like the references in a typical game is generated.
+
+#include <cstdlib>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "console.h"
+#include "cycle_clock.h"
+#include "io_util.h"
+
+struct PathPair {
+    std::string dir;
+    std::string rel;
+};
+
+// The implementation that normalise_path replaced, for comparison.
+static std::string legacy_collapse_path (const std::string &path)
+{
+    std::vector<std::string> dirs;
+    std::string next;
+    for (unsigned i=0 ; i<path.length() ; ++i) {
+        if (path[i] == '/') {
+            dirs.push_back(next);
+            next.clear();
+        } else {
+            next += path[i];
+        }
+    }
+    dirs.push_back(next);
+    std::vector<std::string> dirs2;
+    for (unsigned i=0 ; i<dirs.size() ; ++i) {
+        const std::string &d = dirs[i];
+        if (d == ".") {
+            continue;
+        } else if (d == "..") {
+            if (dirs2.size() == 0)
+                EXCEPT << "Invalid path: " << path << ENDL;
+            dirs2.pop_back();
+        } else if (d == "") {
+        } else {
+            dirs2.push_back(d);
+        }
+    }
+    std::stringstream ss;
+    for (unsigned i=0 ; i<dirs2.size() ; ++i) {
+        ss << "/" + dirs2[i];
+    }
+    return ss.str();
+}
+
+static std::string legacy_absolute_path (const std::string &dir, const std::string &rel)
+{
+    if (rel[0] == '/') return legacy_collapse_path(rel);
+    return legacy_collapse_path(dir + rel);
+}
+
+// Deterministic, so runs can be compared.
+static void generate_corpus (std::vector<PathPair> &out)
+{
+    static const char *dirs[] = {
+        "/", "/common/", "/common/props/", "/common/fonts/", "/system/",
+        "/vehicles/scarman/", "/vehicles/scarman/wheels/", "/playground/buildings/",
+        "/gtasa/map/la/beach/", "/gtasa/map/sf/downtown/blocks/",
+    };
+    static const char *rels[] = {
+        "body.mesh", "textures/body_d.dds", "./init.lua", "../common/props/crate.mesh",
+        "../../materials/metal.lua", "/common/fonts/misc.fnt", "/system/console.lua",
+        "lod//wheel.mesh", "../wheels/./tyre_n.dds", "../../../sounds/engine.wav",
+        "sub/dir/../model.mesh", "/gtasa/map/la/beach/../../sf/bridge.col",
+    };
+    static const size_t num_dirs = sizeof dirs / sizeof *dirs;
+    static const size_t num_rels = sizeof rels / sizeof *rels;
+    for (size_t i=0 ; i<num_dirs ; ++i) {
+        for (size_t j=0 ; j<num_rels ; ++j) {
+            PathPair p = { dirs[i], rels[j] };
+            out.push_back(p);
+        }
+    }
+}
+
+static bool read_corpus (const std::string &filename, std::vector<PathPair> &out)
+{
+    std::ifstream f(filename.c_str());
+    if (!f.good()) return false;
+    PathPair p;
+    while (f >> p.dir >> p.rel) out.push_back(p);
+    return true;
+}
+
+// Nanoseconds per path, best of several runs.
+template<class F> static double time_per_path (const std::vector<PathPair> &corpus, F f)
+{
+    const int runs = 5;
+    const size_t reps = 1 + 2000000 / corpus.size();
+    double best = 0;
+    for (int run=0 ; run<runs ; ++run) {
+        unsigned long long before = nanos();
+        for (size_t r=0 ; r<reps ; ++r) {
+            for (size_t i=0 ; i<corpus.size() ; ++i) f(corpus[i]);
+        }
+        double ns = double(nanos() - before) / (reps * corpus.size());
+        if (run == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+int main (int argc, char **argv)
+{
+    std::vector<PathPair> corpus;
+    if (argc > 2) {
+        CERR << "Usage: " << argv[0] << " [<file>]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (argc == 2) {
+        if (!read_corpus(argv[1], corpus)) {
+            CERR << argv[1] << ": Could not read" << std::endl;
+            return EXIT_FAILURE;
+        }
+    } else {
+        generate_corpus(corpus);
+    }
+    if (corpus.empty()) {
+        CERR << "No paths" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // The results must not have changed, errors included.  Only valid paths
+    // are timed, as building an exception would swamp the rest.
+    std::vector<PathPair> valid;
+    for (size_t i=0 ; i<corpus.size() ; ++i) {
+        const PathPair &p = corpus[i];
+        std::string a, b;
+        try { a = legacy_absolute_path(p.dir, p.rel); } catch (const Exception &) { a = "<invalid>"; }
+        try { b = absolute_path(p.dir, p.rel); } catch (const Exception &) { b = "<invalid>"; }
+        if (a != b) {
+            CERR << p.dir << " " << p.rel << ": got " << b << " expected " << a << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (a != "<invalid>") valid.push_back(p);
+    }
+    if (valid.empty()) {
+        CERR << "No valid paths" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    volatile size_t sink = 0;
+    double legacy = time_per_path(valid, [&] (const PathPair &p) {
+        sink += legacy_absolute_path(p.dir, p.rel).length();
+    });
+    double fresh = time_per_path(valid, [&] (const PathPair &p) {
+        sink += absolute_path(p.dir, p.rel).length();
+    });
+    std::string buf;
+    double reused = time_per_path(valid, [&] (const PathPair &p) {
+        absolute_path(p.dir, p.rel, buf);
+        sink += buf.length();
+    });
+
+    CLOG << corpus.size() << " paths, " << (corpus.size() - valid.size()) << " invalid" << std::endl;
+    CLOG << "legacy:         " << legacy << " ns/path" << std::endl;
+    CLOG << "absolute_path:  " << fresh << " ns/path" << std::endl;
+    CLOG << "reused buffer:  " << reused << " ns/path" << std::endl;
+    return EXIT_SUCCESS;
+}
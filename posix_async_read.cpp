@@ -0,0 +1,301 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "async_read.h"
+
+#ifndef __linux__
+
+AsyncReadBackend *async_read_backend_io_uring (unsigned queue_depth)
+{
+    (void) queue_depth;
+    return NULL;
+}
+
+#else
+
+#include <cerrno>
+#include <cstring>
+
+#include <deque>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include <linux/io_uring.h>
+
+// There is no liburing dependency, so talk to the kernel directly.  See
+// io_uring_setup(2) and io_uring_enter(2) for the ring layout.
+
+static int io_uring_setup (unsigned entries, struct io_uring_params *p)
+{
+    return int(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int io_uring_enter (int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return int(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0));
+}
+
+namespace {
+
+    struct Op {
+        AsyncReadRequest req;
+        int fd;             // opened when the op first gets a slot in the ring
+        size_t done;        // bytes read so far, reads can be short
+        struct iovec iov;
+    };
+
+    class IoUringBackend : public AsyncReadBackend {
+        int ring;
+        void *sqPtr, *cqPtr;
+        size_t sqSize, cqSize;
+        struct io_uring_sqe *sqes;
+        size_t sqesSize;
+
+        unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+        unsigned *cqHead, *cqTail, *cqMask;
+        struct io_uring_cqe *cqes;
+        unsigned entries;
+
+        unsigned inFlight;
+        unsigned unsubmitted;                   // in the ring, not yet entered
+        std::deque<Op*> queue;                  // waiting for a free slot
+        std::vector<AsyncReadResult> ready;     // finished without the kernel
+
+        static void complete (Op *op, const std::string &error, std::vector<AsyncReadResult> &out)
+        {
+            AsyncReadResult res;
+            res.userData = op->req.userData;
+            res.buffer = op->req.buffer;
+            res.bytes = op->done;
+            res.error = error;
+            out.push_back(res);
+            if (op->fd >= 0) close(op->fd);
+            delete op;
+        }
+
+        // Move queued ops into the submission ring and tell the kernel.  Files
+        // are only opened here, so a large batch of requests does not hold a
+        // descriptor for every one while it waits for a slot.
+        void pump (void)
+        {
+            unsigned tail = *sqTail;
+            unsigned added = 0;
+            while (!queue.empty() && inFlight + added < entries) {
+                Op *op = queue.front();
+                if (op->fd < 0) {
+                    op->fd = open(op->req.filename.c_str(), O_RDONLY | O_CLOEXEC);
+                    if (op->fd < 0) {
+                        // Out of descriptors, try again when some ops finish.
+                        if ((errno == EMFILE || errno == ENFILE) && inFlight + added > 0) break;
+                        queue.pop_front();
+                        complete(op, op->req.filename + ": " + strerror(errno), ready);
+                        continue;
+                    }
+                }
+                queue.pop_front();
+                op->iov.iov_base = static_cast<char*>(op->req.buffer) + op->done;
+                op->iov.iov_len = op->req.length - op->done;
+                unsigned idx = tail & *sqMask;
+                struct io_uring_sqe &sqe = sqes[idx];
+                memset(&sqe, 0, sizeof sqe);
+                sqe.opcode = IORING_OP_READV;
+                sqe.fd = op->fd;
+                sqe.off = op->req.offset + op->done;
+                sqe.addr = (unsigned long long)&op->iov;
+                sqe.len = 1;
+                sqe.user_data = (unsigned long long)op;
+                sqArray[idx] = idx;
+                tail++;
+                added++;
+            }
+            inFlight += added;
+            if (added > 0) __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+            unsubmitted += added;
+            while (unsubmitted > 0) {
+                int r = io_uring_enter(ring, unsubmitted, 0, 0);
+                if (r < 0) {
+                    if (errno == EINTR) continue;
+                    // Probably out of resources, the ops stay in the ring
+                    // and are entered next time.
+                    break;
+                }
+                unsubmitted -= r;
+            }
+        }
+
+        // Handle whatever is in the completion ring.
+        void harvest (std::vector<AsyncReadResult> &out)
+        {
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            while (head != tail) {
+                struct io_uring_cqe &cqe = cqes[head & *cqMask];
+                Op *op = reinterpret_cast<Op*>(cqe.user_data);
+                int res = cqe.res;
+                head++;
+                inFlight--;
+                if (res < 0) {
+                    if (res == -EINTR || res == -EAGAIN) {
+                        queue.push_front(op);
+                    } else {
+                        complete(op, op->req.filename + ": " + strerror(-res), out);
+                    }
+                } else if (res == 0) {
+                    // End of file.
+                    complete(op, "", out);
+                } else {
+                    op->done += res;
+                    if (op->done < op->req.length) {
+                        queue.push_front(op);
+                    } else {
+                        complete(op, "", out);
+                    }
+                }
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+
+        public:
+
+        IoUringBackend (int ring, const struct io_uring_params &p,
+                        void *sq_ptr, size_t sq_size, void *cq_ptr, size_t cq_size,
+                        struct io_uring_sqe *sqes, size_t sqes_size)
+          : ring(ring), sqPtr(sq_ptr), cqPtr(cq_ptr), sqSize(sq_size), cqSize(cq_size),
+            sqes(sqes), sqesSize(sqes_size), entries(p.sq_entries), inFlight(0), unsubmitted(0)
+        {
+            char *sq = static_cast<char*>(sq_ptr);
+            sqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+            sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+            sqMask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+            sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+            char *cq = static_cast<char*>(cq_ptr);
+            cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+            cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+            cqMask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+            cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+            // The completion ring is at least as big as the submission one,
+            // so limiting ops in flight to this means it cannot overflow.
+            if (entries > p.cq_entries) entries = p.cq_entries;
+        }
+
+        ~IoUringBackend (void)
+        {
+            for (size_t i=0 ; i<queue.size() ; ++i) {
+                if (queue[i]->fd >= 0) close(queue[i]->fd);
+                delete queue[i];
+            }
+            munmap(sqes, sqesSize);
+            if (cqPtr != sqPtr) munmap(cqPtr, cqSize);
+            munmap(sqPtr, sqSize);
+            close(ring);
+        }
+
+        const char *name (void) const { return "io_uring"; }
+
+        void submit (const AsyncReadRequest &req)
+        {
+            Op *op = new Op();
+            op->req = req;
+            op->done = 0;
+            op->fd = -1;
+            if (req.length == 0) {
+                // Nothing to read, but still report a missing file.
+                op->fd = open(req.filename.c_str(), O_RDONLY | O_CLOEXEC);
+                complete(op, op->fd < 0 ? req.filename + ": " + strerror(errno) : "", ready);
+                return;
+            }
+            queue.push_back(op);
+            pump();
+        }
+
+        void reap (std::vector<AsyncReadResult> &out, size_t min)
+        {
+            size_t got = 0;
+            while (true) {
+                size_t before = out.size();
+                harvest(out);
+                // Resubmit short reads and start queued ops in freed slots.
+                pump();
+                // Ops that failed to open, or finished without the kernel.
+                out.insert(out.end(), ready.begin(), ready.end());
+                ready.clear();
+                got += out.size() - before;
+                if (got >= min || (inFlight == 0 && queue.empty())) break;
+                int r = io_uring_enter(ring, unsubmitted, 1, IORING_ENTER_GETEVENTS);
+                if (r >= 0) {
+                    unsubmitted -= r;
+                } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    break;
+                }
+            }
+        }
+    };
+
+}
+
+AsyncReadBackend *async_read_backend_io_uring (unsigned queue_depth)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof p);
+    int ring = io_uring_setup(queue_depth, &p);
+    if (ring < 0) return NULL;
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && cq_size > sq_size) sq_size = cq_size;
+
+    void *sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        close(ring);
+        return NULL;
+    }
+    void *cq_ptr = sq_ptr;
+    if (!single) {
+        cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            munmap(sq_ptr, sq_size);
+            close(ring);
+            return NULL;
+        }
+    } else {
+        cq_size = sq_size;
+    }
+    size_t sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+        munmap(sq_ptr, sq_size);
+        close(ring);
+        return NULL;
+    }
+    return new IoUringBackend(ring, p, sq_ptr, sq_size, cq_ptr, cq_size,
+                              static_cast<struct io_uring_sqe*>(sqes), sqes_size);
+}
+
+#endif
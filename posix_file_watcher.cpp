@@ -0,0 +1,281 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include "console.h"
+#include "exception.h"
+#include "file_watcher.h"
+#include "io_util.h"
+#include "sleep.h"
+
+#ifndef __linux__
+
+// Only inotify is supported, so refuse to construct a watcher rather than
+// return one that never reports anything.
+
+void FileWatcher::osOpen (void)
+{
+    EXCEPT << "File watching is not supported on this platform" << ENDL;
+}
+
+// Unreachable, as no FileWatcher can be constructed.
+void FileWatcher::osClose (void) { }
+void FileWatcher::osAddWatch (const std::string &, const std::string &) { }
+void FileWatcher::osRead (std::vector<RawEvent> &) { }
+void FileWatcher::osForgetTree (const std::string &, bool, unsigned long long,
+                                std::vector<RawEvent> &) { }
+bool FileWatcher::osWait (unsigned long long) { return false; }
+
+#else
+
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+static const uint32_t watch_mask = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE
+                                 | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+// Subdirectories of dir, or files if want_dirs is false.  Symlinks to
+// directories are neither, as following them could loop forever.
+static void list_dir (const std::string &dir, bool want_dirs, std::vector<std::string> &out)
+{
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL) return;
+    while (struct dirent *ent = readdir(d)) {
+        std::string name = ent->d_name;
+        if (name == "." || name == "..") continue;
+        std::string full = dir + "/" + name;
+        struct stat st;
+        if (lstat(full.c_str(), &st) != 0) continue;
+        if (S_ISLNK(st.st_mode)) {
+            struct stat target;
+            if (stat(full.c_str(), &target) == 0 && S_ISDIR(target.st_mode)) continue;
+        }
+        if (S_ISDIR(st.st_mode) == want_dirs) out.push_back(name);
+    }
+    closedir(d);
+}
+
+void FileWatcher::osOpen (void)
+{
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        EXCEPT << "inotify: " << std::string(strerror(errno)) << std::endl;
+    }
+}
+
+void FileWatcher::osClose (void)
+{
+    close(fd);
+}
+
+void FileWatcher::osAddWatch (const std::string &dir, const std::string &path)
+{
+    int wd = inotify_add_watch(fd, dir.c_str(), watch_mask);
+    if (wd < 0) {
+        EXCEPT << dir << ": " << std::string(strerror(errno)) << std::endl;
+    }
+    // Watching a directory again (e.g. after it was renamed) gives the same
+    // wd, so this also updates the path.
+    Watch &w = watches[wd];
+    w.dir = dir;
+    w.path = absolute_path("/", path);
+    std::vector<std::string> files;
+    list_dir(dir, false, files);
+    w.files = std::set<std::string>(files.begin(), files.end());
+    std::vector<std::string> subdirs;
+    list_dir(dir, true, subdirs);
+    for (size_t i=0 ; i<subdirs.size() ; ++i)
+        osAddWatch(dir + "/" + subdirs[i], w.path + "/" + subdirs[i]);
+}
+
+// Files that appeared with a new directory, before we were watching it.
+static void list_tree (const std::string &dir, const std::string &path,
+                       std::vector<std::string> &out)
+{
+    std::vector<std::string> names;
+    list_dir(dir, false, names);
+    for (size_t i=0 ; i<names.size() ; ++i) out.push_back(path + "/" + names[i]);
+    names.clear();
+    list_dir(dir, true, names);
+    for (size_t i=0 ; i<names.size() ; ++i)
+        list_tree(dir + "/" + names[i], path + "/" + names[i], out);
+}
+
+// Report every file under path as deleted, and optionally stop watching the
+// directories, e.g. when they were moved out of what we watch.
+void FileWatcher::osForgetTree (const std::string &path, bool unwatch, unsigned long long now,
+                                std::vector<RawEvent> &out)
+{
+    std::string prefix = path + "/";
+    for (std::map<int, Watch>::iterator i=watches.begin() ; i!=watches.end() ; ) {
+        const Watch &w = i->second;
+        if (w.path != path && w.path.compare(0, prefix.length(), prefix) != 0) {
+            ++i;
+            continue;
+        }
+        for (std::set<std::string>::const_iterator f=w.files.begin(),
+             f_=w.files.end() ; f!=f_ ; ++f) {
+            RawEvent e = { FileEvent::DELETED, w.path + "/" + *f, "", now };
+            out.push_back(e);
+        }
+        if (unwatch) {
+            // Its IN_IGNORED is then skipped, as the wd is unknown.
+            inotify_rm_watch(fd, i->first);
+            watches.erase(i++);
+        } else {
+            i->second.files.clear();
+            ++i;
+        }
+    }
+}
+
+void FileWatcher::osRead (std::vector<RawEvent> &out)
+{
+    // Aligned as the kernel expects.
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    unsigned long long now = micros();
+    while (true) {
+        ssize_t sz = read(fd, buf, sizeof buf);
+        if (sz < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) CERR << "inotify: " << strerror(errno) << std::endl;
+            break;
+        }
+        if (sz == 0) break;
+        for (char *p = buf ; p < buf + sz ; ) {
+            const struct inotify_event *ev = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                CERR << "inotify: Event queue overflowed, some changes were missed" << std::endl;
+                continue;
+            }
+            std::map<int, Watch>::iterator w = watches.find(ev->wd);
+            if (w == watches.end()) continue;
+            if (ev->mask & IN_IGNORED) {
+                // The directory is gone.  Its files were normally deleted
+                // first, but report any we have not seen go.
+                for (std::set<std::string>::const_iterator f=w->second.files.begin(),
+                     f_=w->second.files.end() ; f!=f_ ; ++f) {
+                    RawEvent e = { FileEvent::DELETED, w->second.path + "/" + *f, "", now };
+                    out.push_back(e);
+                }
+                watches.erase(w);
+                continue;
+            }
+            if (ev->len == 0) continue;
+
+            std::string name = ev->name;
+            std::string path = absolute_path("/", w->second.path + "/" + name);
+
+            if (ev->mask & IN_ISDIR) {
+                if (ev->mask & IN_MOVED_FROM) {
+                    movedDirFrom[ev->cookie] = path;
+                } else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    if (ev->mask & IN_MOVED_TO) {
+                        // Renamed within what we watch, its files are
+                        // reported deleted here and created below.
+                        std::map<unsigned, std::string>::iterator from =
+                            movedDirFrom.find(ev->cookie);
+                        if (from != movedDirFrom.end()) {
+                            osForgetTree(from->second, false, now, out);
+                            movedDirFrom.erase(from);
+                        }
+                    }
+                    std::string dir = w->second.dir + "/" + name;
+                    try {
+                        osAddWatch(dir, path);
+                    } catch (const Exception &) {
+                        // Probably already deleted again.
+                        continue;
+                    }
+                    std::vector<std::string> files;
+                    list_tree(dir, path, files);
+                    for (size_t i=0 ; i<files.size() ; ++i) {
+                        RawEvent e = { FileEvent::CREATED, files[i], "", now };
+                        out.push_back(e);
+                    }
+                }
+                continue;
+            }
+
+            std::set<std::string> &files = w->second.files;
+            RawEvent e = { FileEvent::MODIFIED, path, "", now };
+            if (ev->mask & IN_CREATE) {
+                e.kind = FileEvent::CREATED;
+                files.insert(name);
+            } else if (ev->mask & IN_DELETE) {
+                e.kind = FileEvent::DELETED;
+                files.erase(name);
+            } else if (ev->mask & IN_MOVED_FROM) {
+                movedFrom[ev->cookie] = path;
+                files.erase(name);
+                continue;
+            } else if (ev->mask & IN_MOVED_TO) {
+                files.insert(name);
+                std::map<unsigned, std::string>::iterator from = movedFrom.find(ev->cookie);
+                if (from == movedFrom.end()) {
+                    // Moved in from outside what we watch.
+                    e.kind = FileEvent::CREATED;
+                } else {
+                    e.kind = FileEvent::RENAMED;
+                    e.oldPath = from->second;
+                    movedFrom.erase(from);
+                }
+            }
+            out.push_back(e);
+        }
+    }
+    // The kernel queues both halves of a rename together, so anything left
+    // was moved out of what we watch.
+    for (std::map<unsigned, std::string>::iterator i=movedFrom.begin(),
+         i_=movedFrom.end() ; i!=i_ ; ++i) {
+        RawEvent e = { FileEvent::DELETED, i->second, "", now };
+        out.push_back(e);
+    }
+    movedFrom.clear();
+    // Likewise directories, which also have to stop being watched, or
+    // changes in their new place would be reported under the old path.
+    for (std::map<unsigned, std::string>::iterator i=movedDirFrom.begin(),
+         i_=movedDirFrom.end() ; i!=i_ ; ++i) {
+        osForgetTree(i->second, true, now, out);
+    }
+    movedDirFrom.clear();
+}
+
+bool FileWatcher::osWait (unsigned long long timeout_us)
+{
+    struct pollfd p;
+    p.fd = fd;
+    p.events = POLLIN;
+    p.revents = 0;
+    // Round up, so we do not wake just before a debounce deadline.
+    unsigned long long ms = (timeout_us + 999) / 1000;
+    if (ms > 0x7fffffff) ms = 0x7fffffff;
+    return ::poll(&p, 1, int(ms)) > 0;
+}
+
+#endif
@@ -0,0 +1,147 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+
+#include <climits>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io_util.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+MappedFile::MappedFile (const std::string &filename, bool populate)
+  : base(NULL), len(0), filename(filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        EXCEPT<<filename<<": "<<std::string(strerror(errno))<<std::endl;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        EXCEPT<<filename<<": "<<std::string(strerror(err))<<std::endl;
+    }
+    len = st.st_size;
+    // mmap of 0 bytes fails, an empty file just has no data.
+    if (len == 0) {
+        close(fd);
+        return;
+    }
+    int flags = MAP_PRIVATE;
+    #ifdef MAP_POPULATE
+    if (populate) flags |= MAP_POPULATE;
+    #endif
+    void *p = mmap(NULL, len, PROT_READ, flags, fd, 0);
+    int err = errno;
+    // The mapping keeps the file alive.
+    close(fd);
+    if (p == MAP_FAILED) {
+        EXCEPT<<filename<<": "<<std::string(strerror(err))<<std::endl;
+    }
+    base = static_cast<const char*>(p);
+    #ifndef MAP_POPULATE
+    if (populate) advise(ADVISE_WILLNEED);
+    #endif
+}
+
+MappedFile::~MappedFile (void)
+{
+    if (base != NULL) munmap(const_cast<char*>(base), len);
+}
+
+void MappedFile::advise (Advice advice, size_t offset, size_t sz)
+{
+    if (base == NULL || offset >= len) return;
+    if (sz > len - offset) sz = len - offset;
+    // madvise needs a page aligned start.
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t skew = offset % page;
+    offset -= skew;
+    sz += skew;
+    int a = MADV_NORMAL;
+    switch (advice) {
+        case ADVISE_NORMAL: a = MADV_NORMAL; break;
+        case ADVISE_SEQUENTIAL: a = MADV_SEQUENTIAL; break;
+        case ADVISE_RANDOM: a = MADV_RANDOM; break;
+        case ADVISE_WILLNEED: a = MADV_WILLNEED; break;
+    }
+    madvise(const_cast<char*>(base) + offset, sz, a);
+}
+
+void BufferedOutFile::osOpen (void)
+{
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        EXCEPT<<filename<<": "<<std::string(strerror(errno))<<std::endl;
+    }
+    handle = fd;
+}
+
+void BufferedOutFile::osClose (void)
+{
+    if (close(int(handle)) != 0) setError(strerror(errno));
+}
+
+std::string BufferedOutFile::osWrite (const Span<const char> *bufs, size_t n)
+{
+    std::vector<struct iovec> iov(n);
+    for (size_t i=0 ; i<n ; ++i) {
+        iov[i].iov_base = const_cast<char*>(bufs[i].data());
+        iov[i].iov_len = bufs[i].size();
+    }
+    size_t i = 0;
+    while (i < n) {
+        int count = int(std::min(n - i, size_t(IOV_MAX)));
+        ssize_t r = ::writev(int(handle), &iov[i], count);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return strerror(errno);
+        }
+        // Skip whatever was written, which may end part way through an array.
+        size_t done = r;
+        while (i < n && done >= iov[i].iov_len) {
+            done -= iov[i].iov_len;
+            ++i;
+        }
+        if (done > 0) {
+            iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + done;
+            iov[i].iov_len -= done;
+        }
+    }
+    return "";
+}
+
+std::string BufferedOutFile::osSync (void)
+{
+    if (fsync(int(handle)) != 0) return strerror(errno);
+    return "";
+}
@@ -19,19 +19,48 @@
  * THE SOFTWARE.
  */
 
-#define _POSIX_C_SOURCE 199309
+#define _POSIX_C_SOURCE 200112L
 #include <ctime>
 #include <cassert>
+#include <cerrno>
 #include <cstdio>
 
+#include "sleep.h"
+
 void mysleep(long micros)
 {
         if (micros<=0) return;
-        struct timespec t = {0,micros*1000};
-        int r = nanosleep(&t, NULL);
+        struct timespec t = {micros/1000000, (micros%1000000)*1000};
+        // Resume after signals, rather than returning early.
+        while (nanosleep(&t, &t)) {
+                if (errno != EINTR) {
+                        perror("sleep");
+                        return;
+                }
+        }
+}
+
+void mysleep_until (unsigned long long deadline_ns)
+{
+#ifdef TIMER_ABSTIME
+        struct timespec t = {time_t(deadline_ns/1000000000ULL), long(deadline_ns%1000000000ULL)};
+        int r;
+        while ((r = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL)) == EINTR) { }
         if (r) {
+                errno = r;
                 perror("sleep");
         }
+#else
+        unsigned long long now = clock_nanos();
+        if (now < deadline_ns) mysleep(long((deadline_ns - now) / 1000));
+#endif
+}
+
+unsigned long long clock_nanos (void)
+{
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return ((unsigned long long)t.tv_sec)*1000000000ULL + ((unsigned long long)t.tv_nsec);
 }
 
 unsigned long long micros (void) {
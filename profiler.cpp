@@ -0,0 +1,358 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+#include "console.h"
+#include "io_util.h"
+#include "lua_util.h"
+#include "profiler.h"
+
+namespace {
+
+    const size_t RING_SIZE = 65536;  // events, a power of 2
+
+    // Written by its thread, read by profiler_frame, in the same way as the
+    // logger's rings.
+    struct ThreadBuffer {
+        std::vector<ProfileEvent> ring;
+        std::atomic<unsigned long long> head;
+        std::atomic<unsigned long long> tail;
+        std::atomic<unsigned long> dropped;
+        std::atomic<bool> dead;
+        unsigned id;
+        std::string name;
+
+        ThreadBuffer (unsigned id)
+          : ring(RING_SIZE), head(0), tail(0), dropped(0), dead(false), id(id)
+        { }
+    };
+
+    std::atomic<bool> enabled(true);
+
+    std::mutex buffers_mutex;
+    std::vector<ThreadBuffer*> buffers;
+    unsigned next_thread_id = 1;
+
+    bool capturing = false;
+    std::vector<ProfileEvent> captured;
+    // Names of threads that have exited while capturing, for the trace.
+    std::vector<std::pair<unsigned, std::string> > dead_names;
+
+    std::mutex intern_mutex;
+    std::set<std::string> interned;
+
+    ThreadBuffer *add_buffer (void)
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        ThreadBuffer *b = new ThreadBuffer(next_thread_id++);
+        buffers.push_back(b);
+        return b;
+    }
+
+    struct BufferOwner {
+        ThreadBuffer *buffer;
+        BufferOwner (void) : buffer(add_buffer()) { }
+        ~BufferOwner (void) { buffer->dead = true; }
+    };
+
+    ThreadBuffer &thread_buffer (void)
+    {
+        static thread_local BufferOwner owner;
+        return *owner.buffer;
+    }
+
+    // Move everything buffered into out.  Call with buffers_mutex held.
+    void drain (std::vector<ProfileEvent> &out)
+    {
+        for (size_t i=0 ; i<buffers.size() ; ) {
+            ThreadBuffer *b = buffers[i];
+            bool dead = b->dead.load();
+            unsigned long long t = b->tail.load(std::memory_order_relaxed);
+            unsigned long long h = b->head.load(std::memory_order_acquire);
+            for ( ; t != h ; ++t) {
+                out.push_back(b->ring[t & (RING_SIZE - 1)]);
+                out.back().thread = b->id;
+            }
+            b->tail.store(t, std::memory_order_release);
+            unsigned long lost = b->dropped.exchange(0);
+            if (lost > 0) CERR << "Profiler: dropped " << lost << " zones from thread " << b->id << std::endl;
+            if (dead) {
+                if (capturing && !b->name.empty()) dead_names.push_back(std::make_pair(b->id, b->name));
+                buffers[i] = buffers.back();
+                buffers.pop_back();
+                delete b;
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    void json_string (std::string &out, const char *s)
+    {
+        out += '"';
+        for ( ; *s != '\0' ; ++s) {
+            unsigned char c = *s;
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof buf, "\\u%04x", c);
+                out += buf;
+            } else {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+
+    void json_thread_name (std::string &out, unsigned id, const std::string &name)
+    {
+        char buf[64];
+        snprintf(buf, sizeof buf, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,", id);
+        out += buf;
+        out += "\"args\":{\"name\":";
+        json_string(out, name.c_str());
+        out += "}},\n";
+    }
+
+    // Zones opened by profile_begin.  Unlike a ProfileZone, nothing closes
+    // one if a script error skips its profile_end.
+    struct LuaZone {
+        const char *name;
+        const char *category;
+        unsigned long long begin;
+        unsigned depth;     // profiler_depth() before it was opened
+    };
+
+    std::vector<LuaZone> &lua_zones (void)
+    {
+        static thread_local std::vector<LuaZone> zones;
+        return zones;
+    }
+
+}
+
+unsigned &profiler_depth (void)
+{
+    static thread_local unsigned depth = 0;
+    return depth;
+}
+
+void profiler_set_enabled (bool v)
+{
+    enabled = v;
+}
+
+bool profiler_enabled (void)
+{
+    return enabled.load(std::memory_order_relaxed);
+}
+
+void profiler_record (const char *name, const char *category, const char *arg_name,
+                      long long arg, unsigned long long begin, unsigned long long end)
+{
+    ThreadBuffer &b = thread_buffer();
+    unsigned long long h = b.head.load(std::memory_order_relaxed);
+    if (h - b.tail.load(std::memory_order_acquire) >= RING_SIZE) {
+        b.dropped++;
+        return;
+    }
+    ProfileEvent &e = b.ring[h & (RING_SIZE - 1)];
+    e.name = name;
+    e.category = category;
+    e.argName = arg_name;
+    e.arg = arg;
+    e.begin = begin;
+    e.end = end;
+    e.depth = profiler_depth();
+    b.head.store(h + 1, std::memory_order_release);
+}
+
+std::vector<ProfileZoneStats> profiler_frame (void)
+{
+    // Lua zones left open (e.g. by an error) would otherwise stay on the
+    // stack and inflate the depth of every later zone on this thread.
+    std::vector<LuaZone> &zones = lua_zones();
+    if (!zones.empty()) {
+        for (const LuaZone &z : zones)
+            CERR << "profile_begin(\"" << z.name << "\") was not closed by profile_end()" << std::endl;
+        // Each still counts once, whatever has opened and closed since.
+        unsigned &depth = profiler_depth();
+        depth -= std::min(depth, unsigned(zones.size()));
+        zones.clear();
+    }
+
+    std::vector<ProfileEvent> events;
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        drain(events);
+        if (capturing) captured.insert(captured.end(), events.begin(), events.end());
+    }
+
+    // Keyed by pointer for speed, then merged by text in case the same
+    // literal appears at different addresses.
+    std::unordered_map<const char*, ProfileZoneStats> by_ptr;
+    for (const ProfileEvent &e : events) {
+        ProfileZoneStats &s = by_ptr[e.name];
+        unsigned long long dur = e.end - e.begin;
+        if (s.name == NULL) {
+            s.name = e.name;
+            s.category = e.category;
+            s.count = 0;
+            s.totalNs = 0;
+            s.maxNs = 0;
+        }
+        s.count++;
+        s.totalNs += dur;
+        s.maxNs = std::max(s.maxNs, dur);
+    }
+    std::vector<ProfileZoneStats> r;
+    for (const auto &pair : by_ptr) r.push_back(pair.second);
+    std::sort(r.begin(), r.end(), [] (const ProfileZoneStats &a, const ProfileZoneStats &b) {
+        return strcmp(a.name, b.name) < 0;
+    });
+    size_t n = 0;
+    for (size_t i=0 ; i<r.size() ; ++i) {
+        if (n > 0 && !strcmp(r[n-1].name, r[i].name)) {
+            r[n-1].count += r[i].count;
+            r[n-1].totalNs += r[i].totalNs;
+            r[n-1].maxNs = std::max(r[n-1].maxNs, r[i].maxNs);
+        } else {
+            r[n++] = r[i];
+        }
+    }
+    r.resize(n);
+    std::sort(r.begin(), r.end(), [] (const ProfileZoneStats &a, const ProfileZoneStats &b) {
+        return a.totalNs > b.totalNs;
+    });
+    return r;
+}
+
+void profiler_set_thread_name (const std::string &name)
+{
+    ThreadBuffer &b = thread_buffer();
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    b.name = name;
+}
+
+const char *profiler_intern (const std::string &s)
+{
+    std::lock_guard<std::mutex> lock(intern_mutex);
+    return interned.insert(s).first->c_str();
+}
+
+void profiler_capture_begin (void)
+{
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    capturing = true;
+    captured.clear();
+    dead_names.clear();
+}
+
+void profiler_capture_end (const std::string &filename)
+{
+    std::vector<ProfileEvent> events;
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        drain(captured);
+        capturing = false;
+        events.swap(captured);
+        for (const ThreadBuffer *b : buffers) {
+            if (!b->name.empty()) json_thread_name(out, b->id, b->name);
+        }
+        for (const auto &pair : dead_names) json_thread_name(out, pair.first, pair.second);
+    }
+
+    BufferedOutFile f(filename);
+    unsigned long long origin = ~0ULL;
+    for (const ProfileEvent &e : events) origin = std::min(origin, e.begin);
+    char buf[128];
+    for (size_t i=0 ; i<events.size() ; ++i) {
+        const ProfileEvent &e = events[i];
+        out += "{\"name\":";
+        json_string(out, e.name);
+        out += ",\"cat\":";
+        json_string(out, e.category);
+        // Microseconds, with the fraction so that short zones still show.
+        snprintf(buf, sizeof buf, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                 e.thread, (e.begin - origin) / 1000.0, (e.end - e.begin) / 1000.0);
+        out += buf;
+        if (e.argName != NULL) {
+            out += ",\"args\":{";
+            json_string(out, e.argName);
+            snprintf(buf, sizeof buf, ":%lld}", e.arg);
+            out += buf;
+        }
+        out += "},\n";
+        if (out.size() > 65536) {
+            f.write_bytes(out.data(), out.size());
+            out.clear();
+        }
+    }
+    // A metadata event last, so that every real one can end with a comma.
+    out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"grit\"}}\n]}\n";
+    f.write_bytes(out.data(), out.size());
+    f.flush();
+}
+
+static int global_profile_begin (lua_State *L)
+{
+    LuaZone z;
+    z.name = profiler_intern(luaL_checkstring(L, 1));
+    z.category = profiler_intern(luaL_optstring(L, 2, "lua"));
+    z.begin = profiler_enabled() ? nanos() : 0;
+    z.depth = profiler_depth();
+    lua_zones().push_back(z);
+    profiler_depth()++;
+    return 0;
+}
+
+static int global_profile_end (lua_State *L)
+{
+    std::vector<LuaZone> &zones = lua_zones();
+    if (zones.empty()) my_lua_error(L, "profile_end() without profile_begin()");
+    LuaZone z = zones.back();
+    zones.pop_back();
+    profiler_depth() = z.depth;
+    if (z.begin != 0) profiler_record(z.name, z.category, NULL, 0, z.begin, nanos());
+    return 0;
+}
+
+static const luaL_reg profiler_globals[] = {
+    {"profile_begin", global_profile_begin},
+    {"profile_end", global_profile_end},
+    {NULL, NULL}
+};
+
+void profiler_lua_init (lua_State *L)
+{
+    register_lua_globals(L, profiler_globals);
+}
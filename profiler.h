@@ -0,0 +1,138 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+#include "cycle_clock.h"
+
+/** One timed zone, as recorded by the thread that ran it.  Times are from
+ * nanos(). */
+struct ProfileEvent {
+    const char *name;
+    const char *category;
+    const char *argName;    // NULL if there is no argument
+    long long arg;
+    unsigned long long begin, end;
+    unsigned thread;        // see profiler_set_thread_name
+    unsigned depth;         // number of enclosing zones on the same thread
+};
+
+/** Aggregate of all the zones with the same name in one frame. */
+struct ProfileZoneStats {
+    const char *name;
+    const char *category;
+    unsigned long count;
+    unsigned long long totalNs;
+    unsigned long long maxNs;
+};
+
+/** Record a finished zone from the calling thread.  Lock-free.  The strings
+ * must live forever, e.g. literals or profiler_intern.  Dropped if the
+ * thread has recorded 64K zones since the last profiler_frame. */
+void profiler_record (const char *name, const char *category, const char *arg_name,
+                      long long arg, unsigned long long begin, unsigned long long end);
+
+/** Zones currently open on the calling thread, for nesting. */
+unsigned &profiler_depth (void);
+
+/** Whether zones are recorded at all.  Default true. */
+void profiler_set_enabled (bool v);
+bool profiler_enabled (void);
+
+/** Times its own scope, see PROFILE_ZONE. */
+class ProfileZone {
+    const char *name, *category, *argName;
+    long long arg;
+    unsigned long long begin;
+
+    public:
+
+    ProfileZone (const char *name, const char *category,
+                 const char *arg_name=NULL, long long arg=0)
+      : name(name), category(category), argName(arg_name), arg(arg),
+        begin(profiler_enabled() ? nanos() : 0)
+    {
+        profiler_depth()++;
+    }
+
+    ~ProfileZone (void)
+    {
+        profiler_depth()--;
+        if (begin != 0) profiler_record(name, category, argName, arg, begin, nanos());
+    }
+
+    ProfileZone (const ProfileZone &) = delete;
+    ProfileZone &operator= (const ProfileZone &) = delete;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+
+/* Time the rest of the enclosing scope:
+ *     PROFILE_ZONE("physics", "sim");
+ *     PROFILE_ZONE_ARG("load mesh", "io", "bytes", sz);
+ * Build with -DNO_PROFILER to remove them entirely, arguments included. */
+#ifdef NO_PROFILER
+#define PROFILE_ZONE(name, category) ((void)0)
+#define PROFILE_ZONE_ARG(name, category, arg_name, arg) ((void)0)
+#else
+#define PROFILE_ZONE(name, category) \
+    ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name, category)
+#define PROFILE_ZONE_ARG(name, category, arg_name, arg) \
+    ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name, category, arg_name, (long long)(arg))
+#endif
+
+/** Collect what every thread has recorded since the last call, and return
+ * the totals per zone name, most expensive first.  Call once per frame from
+ * one thread.  Zones still open are counted in the frame they finish. */
+std::vector<ProfileZoneStats> profiler_frame (void);
+
+/** Name the calling thread in traces, e.g. "main" or "physics". */
+void profiler_set_thread_name (const std::string &name);
+
+/** A copy of the string that lives forever, for zone names that are not
+ * literals.  The same text always gives the same pointer. */
+const char *profiler_intern (const std::string &s);
+
+/** Start keeping every event collected by profiler_frame. */
+void profiler_capture_begin (void);
+
+/** Stop keeping events and write them as Chrome trace event JSON, for
+ * Perfetto or about:tracing.  Throws if the file cannot be written. */
+void profiler_capture_end (const std::string &filename);
+
+/** Add profile_begin(name [, category]) and profile_end() to the globals.
+ * Zones opened by Lua must be closed in the reverse order, and in the same
+ * frame.  Any still open when profiler_frame is called on their thread (e.g.
+ * because an error skipped profile_end) are reported and discarded. */
+void profiler_lua_init (lua_State *L);
+
+#endif
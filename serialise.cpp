@@ -0,0 +1,136 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "serialise.h"
+
+// SerialiseWords relies on these having no padding.
+static_assert(sizeof(Vector2) == 2*4, "Vector2 is not packed");
+static_assert(sizeof(Vector3) == 3*4, "Vector3 is not packed");
+static_assert(sizeof(Vector4) == 4*4, "Vector4 is not packed");
+static_assert(sizeof(Quaternion) == 4*4, "Quaternion is not packed");
+static_assert(sizeof(SimpleTransform) == 7*4, "SimpleTransform is not packed");
+
+static const unsigned char ENDIAN_BYTE_LITTLE = 0;
+static const unsigned char ENDIAN_BYTE_BIG = 1;
+
+void endian_swap_words (void *data, size_t n)
+{
+    // Simple enough for the compiler to vectorise (e.g. into pshufb).
+    unsigned char *p = static_cast<unsigned char*>(data);
+    for (size_t i=0 ; i<n ; ++i) {
+        unsigned char *w = p + 4*i;
+        unsigned char a = w[0], b = w[1];
+        w[0] = w[3];
+        w[1] = w[2];
+        w[2] = b;
+        w[3] = a;
+    }
+}
+
+BinaryWriter::BinaryWriter (BufferedOutFile &out, const char *tag, unsigned version)
+  : out(out)
+{
+    out.write_bytes(tag, 4);
+    unsigned char header[4] = { 0, 0, 0, 0 };
+    header[0] = out.getEndian() == ENDIAN_BIG ? ENDIAN_BYTE_BIG : ENDIAN_BYTE_LITTLE;
+    out.write_bytes(header, sizeof header);
+    out.write(version);
+}
+
+void BinaryWriter::writeVarint (unsigned long long v)
+{
+    unsigned char buf[10];
+    size_t sz = 0;
+    while (v >= 0x80) {
+        buf[sz++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    buf[sz++] = (unsigned char)v;
+    out.write_bytes(buf, sz);
+}
+
+void BinaryWriter::writeWordsSwapped (const void *data, size_t n)
+{
+    // Convert a piece at a time so the scratch space stays small.
+    const size_t piece = 16384;
+    scratch.resize(piece * 4);
+    const char *src = static_cast<const char*>(data);
+    while (n > 0) {
+        size_t count = std::min(n, piece);
+        memcpy(&scratch[0], src, count * 4);
+        endian_swap_words(&scratch[0], count);
+        out.write_bytes(&scratch[0], count * 4);
+        src += count * 4;
+        n -= count;
+    }
+}
+
+BinaryReader::BinaryReader (BufferedInFile &in, const char *tag, unsigned max_version)
+  : in(in)
+{
+    char got[4];
+    in.read_bytes(got, 4);
+    if (memcmp(got, tag, 4) != 0) {
+        EXCEPT << in.filename << ": Not a " << std::string(tag, 4) << " file" << ENDL;
+    }
+    unsigned char header[4];
+    in.read_bytes(header, sizeof header);
+    switch (header[0]) {
+        case ENDIAN_BYTE_LITTLE: in.setEndian(ENDIAN_LITTLE); break;
+        case ENDIAN_BYTE_BIG: in.setEndian(ENDIAN_BIG); break;
+        default:
+        EXCEPT << in.filename << ": Corrupt header" << ENDL;
+    }
+    in.read(version);
+    if (version > max_version) {
+        EXCEPT << in.filename << ": Version " << version << " of " << std::string(tag, 4)
+               << " is too new (can read up to " << max_version << ")" << ENDL;
+    }
+}
+
+unsigned long long BinaryReader::readVarint (void)
+{
+    unsigned long long v = 0;
+    for (unsigned shift=0 ; shift<64 ; shift+=7) {
+        unsigned char b = in.read<unsigned char>();
+        v |= (unsigned long long)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return v;
+    }
+    EXCEPT << in.filename << ": offset " << in.tell() << ": Corrupt varint" << ENDL;
+}
+
+void BinaryReader::readString (std::string &s)
+{
+    unsigned long long n = readVarint();
+    s.clear();
+    char buf[4096];
+    while (s.length() < n) {
+        size_t count = size_t(std::min<unsigned long long>(n - s.length(), sizeof buf));
+        in.read_bytes(buf, count);
+        s.append(buf, count);
+    }
+}
+
+void BinaryReader::readWords (void *data, size_t n)
+{
+    in.read_bytes(data, n * 4);
+    if (in.getEndian() != endian_native()) endian_swap_words(data, n);
+}
@@ -0,0 +1,204 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SERIALISE_H
+#define SERIALISE_H
+
+#include <cstdlib>
+#include <cstring>
+
+#include <string>
+#include <vector>
+
+#include "io_util.h"
+#include "math_util.h"
+#include "span.h"
+
+/* Byte order conversion for the engine's maths types.  These are found by
+ * BufferedInFile::read and BufferedOutFile::write when the file's byte order
+ * is not the host's. */
+inline void endian_swap (Vector2 &v) { endian_swap(v.x); endian_swap(v.y); }
+inline void endian_swap (Vector3 &v) { endian_swap(v.x); endian_swap(v.y); endian_swap(v.z); }
+inline void endian_swap (Vector4 &v)
+{ endian_swap(v.x); endian_swap(v.y); endian_swap(v.z); endian_swap(v.w); }
+inline void endian_swap (Quaternion &v)
+{ endian_swap(v.w); endian_swap(v.x); endian_swap(v.y); endian_swap(v.z); }
+inline void endian_swap (SimpleTransform &v) { endian_swap(v.pos); endian_swap(v.quat); }
+
+/** Whether T is just 4 byte words, and so arrays of it can have their byte
+ * order converted as one flat array of words. */
+template<class T> struct SerialiseWords { static const bool value = false; };
+template<> struct SerialiseWords<float> { static const bool value = true; };
+template<> struct SerialiseWords<int> { static const bool value = true; };
+template<> struct SerialiseWords<unsigned> { static const bool value = true; };
+template<> struct SerialiseWords<Vector2> { static const bool value = true; };
+template<> struct SerialiseWords<Vector3> { static const bool value = true; };
+template<> struct SerialiseWords<Vector4> { static const bool value = true; };
+template<> struct SerialiseWords<Quaternion> { static const bool value = true; };
+template<> struct SerialiseWords<SimpleTransform> { static const bool value = true; };
+
+/** Reverse the byte order of each of n 4 byte words, in place. */
+void endian_swap_words (void *data, size_t n);
+
+/* A binary file written with BinaryWriter starts with a header:
+ *
+ *   char[4] tag         identifies the format, e.g. "MESH"
+ *   byte endian         0 = little endian, 1 = big endian
+ *   byte[3] reserved    0
+ *   u32 version         of the format, in the above byte order
+ *
+ * followed by whatever the format writes.  The writer may use either byte
+ * order, the reader converts if necessary.  Arrays are prefixed by their
+ * length as a varint.
+ */
+
+/** Writes a tagged, versioned binary format over a BufferedOutFile. */
+class BinaryWriter {
+    BufferedOutFile &out;
+    std::vector<char> scratch;
+
+    void writeWordsSwapped (const void *data, size_t n);
+
+    public:
+
+    /** Writes the header, in the byte order of out. */
+    BinaryWriter (BufferedOutFile &out, const char *tag, unsigned version);
+
+    BufferedOutFile &getFile (void) { return out; }
+
+    template<class T> void write (const T &v) { out.write(v); }
+
+    /** Unsigned LEB128, 1 byte for values under 128. */
+    void writeVarint (unsigned long long v);
+
+    /** Zigzag encoded so that small negative numbers are small too. */
+    void writeSignedVarint (long long v)
+    {
+        writeVarint((static_cast<unsigned long long>(v) << 1) ^ static_cast<unsigned long long>(v >> 63));
+    }
+
+    void writeString (const std::string &s)
+    {
+        writeVarint(s.length());
+        out.write_bytes(s.data(), s.length());
+    }
+
+    /** Length and then the elements.  Arrays of maths types are copied in
+     * bulk (and converted in bulk if necessary) rather than one at a time. */
+    template<class T> void writeArray (Span<const T> arr)
+    {
+        writeVarint(arr.size());
+        if (out.getEndian() == endian_native() || sizeof(T) == 1) {
+            out.write_bytes(arr.data(), arr.bytes());
+        } else if (SerialiseWords<T>::value) {
+            writeWordsSwapped(arr.data(), arr.bytes() / 4);
+        } else {
+            for (size_t i=0 ; i<arr.size() ; ++i) out.write(arr[i]);
+        }
+    }
+    template<class T> void writeArray (const std::vector<T> &arr)
+    { writeArray(Span<const T>(arr)); }
+
+    /** For sorted or slowly changing integers (indexes, timestamps, ids):
+     * length and then the differences between consecutive values as signed
+     * varints. */
+    template<class T> void writeDeltas (Span<const T> arr)
+    {
+        writeVarint(arr.size());
+        unsigned long long prev = 0;
+        for (size_t i=0 ; i<arr.size() ; ++i) {
+            unsigned long long v = static_cast<unsigned long long>(arr[i]);
+            writeSignedVarint(static_cast<long long>(v - prev));
+            prev = v;
+        }
+    }
+    template<class T> void writeDeltas (const std::vector<T> &arr)
+    { writeDeltas(Span<const T>(arr)); }
+};
+
+/** Reads a format written by BinaryWriter.  Throws an Exception for the wrong
+ * tag, a version newer than the reader understands, or a truncated file. */
+class BinaryReader {
+    BufferedInFile &in;
+    unsigned version;
+
+    // Arrays are read in pieces of this many bytes, so that a corrupt length
+    // runs out of file rather than memory.
+    static const size_t PIECE = 1 << 20;
+
+    void readWords (void *data, size_t n);
+
+    public:
+
+    /** Reads the header and sets the byte order of in from it.
+     * \param max_version The newest version of the format the caller can
+     *        read.  Older versions are accepted, see getVersion. */
+    BinaryReader (BufferedInFile &in, const char *tag, unsigned max_version);
+
+    BufferedInFile &getFile (void) { return in; }
+
+    /** The version of the format in the file, for the caller to handle
+     * older layouts. */
+    unsigned getVersion (void) const { return version; }
+
+    template<class T> void read (T &v) { in.read(v); }
+    template<class T> T read (void) { return in.read<T>(); }
+
+    unsigned long long readVarint (void);
+
+    long long readSignedVarint (void)
+    {
+        unsigned long long v = readVarint();
+        return static_cast<long long>((v >> 1) ^ (~(v & 1) + 1));
+    }
+
+    void readString (std::string &s);
+
+    template<class T> void readArray (std::vector<T> &arr)
+    {
+        unsigned long long n = readVarint();
+        arr.clear();
+        const size_t piece = PIECE / sizeof(T) + 1;
+        while (arr.size() < n) {
+            size_t first = arr.size();
+            size_t count = size_t(std::min<unsigned long long>(n - first, piece));
+            arr.resize(first + count);
+            if (SerialiseWords<T>::value) {
+                readWords(&arr[first], count * sizeof(T) / 4);
+            } else {
+                in.read_array(Span<T>(&arr[first], count));
+            }
+        }
+    }
+
+    template<class T> void readDeltas (std::vector<T> &arr)
+    {
+        unsigned long long n = readVarint();
+        arr.clear();
+        unsigned long long prev = 0;
+        for (unsigned long long i=0 ; i<n ; ++i) {
+            prev += static_cast<unsigned long long>(readSignedVarint());
+            arr.push_back(static_cast<T>(prev));
+        }
+    }
+};
+
+#endif
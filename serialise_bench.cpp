@@ -0,0 +1,141 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Measures the throughput of BinaryWriter and BinaryReader (see serialise.h),
+// against writing and reading one value at a time through OutFile and InFile.
+// Usage: serialise_bench [<scratch file> [<count>]]
+// The scratch file (default serialise_bench.tmp) is removed afterwards.  Reads
+// are mostly from the page cache, as the file was just written.
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include "console.h"
+#include "cycle_clock.h"
+#include "io_util.h"
+#include "serialise.h"
+
+static void report (const char *what, size_t bytes, unsigned long long ns)
+{
+    double mb_per_s = ns == 0 ? 0 : bytes / (ns / 1e9) / (1024 * 1024);
+    CLOG << std::left << std::setw(30) << what << mb_per_s << " MB/s" << std::endl;
+}
+
+int main (int argc, char **argv)
+{
+    if (argc > 3) {
+        CERR << "Usage:" << argv[0] << " [<scratch file> [<count>]]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::string filename = argc > 1 ? argv[1] : "serialise_bench.tmp";
+    size_t count = argc > 2 ? size_t(strtoull(argv[2], NULL, 10)) : 4 * 1024 * 1024;
+    if (count == 0) count = 1;
+
+    std::vector<Vector3> verts(count);
+    for (size_t i=0 ; i<count ; ++i) verts[i] = Vector3(float(i), i * 0.5f, -float(i));
+    // Like an index buffer: increasing, with small steps.
+    std::vector<unsigned> indexes(count);
+    for (size_t i=0 ; i<count ; ++i) indexes[i] = unsigned(i + i % 7);
+    size_t vert_bytes = count * sizeof(Vector3);
+    size_t index_bytes = count * sizeof(unsigned);
+
+    CLOG << count << " Vector3 (" << vert_bytes / (1024 * 1024) << "MB)" << std::endl;
+
+    try {
+        unsigned long long before = nanos();
+        {
+            OutFile f(filename);
+            for (size_t i=0 ; i<count ; ++i) f.write(verts[i]);
+        }
+        report("OutFile per value, write:", vert_bytes, nanos() - before);
+
+        std::vector<Vector3> got(count);
+        before = nanos();
+        {
+            InFile f(filename);
+            for (size_t i=0 ; i<count ; ++i) f.read(got[i]);
+        }
+        report("InFile per value, read:", vert_bytes, nanos() - before);
+
+        for (int swapped=0 ; swapped<2 ; ++swapped) {
+            Endianness endian = swapped ? endian_other() : endian_native();
+            before = nanos();
+            {
+                BufferedOutFile f(filename, endian);
+                BinaryWriter w(f, "BNCH", 1);
+                w.writeArray(verts);
+                f.flush();
+            }
+            report(swapped ? "BinaryWriter swapped, write:" : "BinaryWriter, write:",
+                   vert_bytes, nanos() - before);
+
+            got.clear();
+            before = nanos();
+            {
+                BufferedInFile f(filename);
+                BinaryReader r(f, "BNCH", 1);
+                r.readArray(got);
+            }
+            report(swapped ? "BinaryReader swapped, read:" : "BinaryReader, read:",
+                   vert_bytes, nanos() - before);
+            if (got.size() != count || got[count - 1].z != verts[count - 1].z) {
+                CERR << filename << ": Read back the wrong data" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        // MB/s of the original integers, not of the smaller encoding.
+        unsigned long long encoded;
+        before = nanos();
+        {
+            BufferedOutFile f(filename);
+            BinaryWriter w(f, "BNCH", 1);
+            w.writeDeltas(indexes);
+            f.flush();
+            encoded = f.tell();
+        }
+        report("writeDeltas, write:", index_bytes, nanos() - before);
+
+        std::vector<unsigned> got_indexes;
+        before = nanos();
+        {
+            BufferedInFile f(filename);
+            BinaryReader r(f, "BNCH", 1);
+            r.readDeltas(got_indexes);
+        }
+        report("readDeltas, read:", index_bytes, nanos() - before);
+        if (got_indexes != indexes) {
+            CERR << filename << ": Read back the wrong deltas" << std::endl;
+            return EXIT_FAILURE;
+        }
+        CLOG << "Deltas took " << encoded << " bytes for " << index_bytes << std::endl;
+    } catch (const Exception &e) {
+        CERR << e << std::endl;
+        std::remove(filename.c_str());
+        return EXIT_FAILURE;
+    }
+    std::remove(filename.c_str());
+    return EXIT_SUCCESS;
+}
@@ -24,6 +24,15 @@
  * microseconds. */
 void mysleep (long micros);
 
+/** Platform portability wrapper: sleep (with idle CPU) until clock_nanos()
+ * reaches the deadline.  May wake late by the scheduler's slack, see
+ * FramePacer for precise waits. */
+void mysleep_until (unsigned long long deadline_ns);
+
+/** Platform portability wrapper: Return the number of nanoseconds since some
+ * fixed epoch, from the OS monotonic clock. */
+unsigned long long clock_nanos (void);
+
 /** Platform portability wrapper: Return the number of microseconds since some
  * fixed epoch. */
 unsigned long long micros (void);
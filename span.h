@@ -0,0 +1,54 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SPAN_H
+#define SPAN_H
+
+#include <cstdlib>
+
+/** A pointer and a number of elements, like C++20's std::span.  Does not own
+ * the memory.  Can be made from an array, or anything with data() and size()
+ * such as std::vector. */
+template<class T> class Span {
+    T *ptr;
+    size_t len;
+
+    public:
+
+    Span (void) : ptr(NULL), len(0) { }
+    Span (T *ptr, size_t len) : ptr(ptr), len(len) { }
+    template<size_t N> Span (T (&arr)[N]) : ptr(arr), len(N) { }
+    template<class C> Span (C &c) : ptr(c.data()), len(c.size()) { }
+
+    T *data (void) const { return ptr; }
+    size_t size (void) const { return len; }
+    size_t bytes (void) const { return len * sizeof(T); }
+    bool empty (void) const { return len == 0; }
+
+    T &operator[] (size_t i) const { return ptr[i]; }
+    T *begin (void) const { return ptr; }
+    T *end (void) const { return ptr + len; }
+
+    /** The elements [off, off+n), which must be in range. */
+    Span subspan (size_t off, size_t n) const { return Span(ptr + off, n); }
+};
+
+#endif
@@ -0,0 +1,439 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cmath>
+
+#include <algorithm>
+
+#include "console.h"
+#include "lua_util.h"
+#include "lua_wrappers_common.h"
+#include "timer_wheel.h"
+
+const unsigned TimerWheel::NIL;
+
+TimerWheel::TimerWheel (unsigned long long tick_us, unsigned long long now_us)
+  : tickUs(tick_us == 0 ? 1 : tick_us), baseUs(now_us), current(0), freeList(NIL), pending(0)
+{
+    std::fill(heads, heads + LEVELS * SLOTS + 1, NIL);
+    std::fill(&occupied[0][0], &occupied[0][0] + LEVELS * SLOTS / 64, 0);
+}
+
+unsigned TimerWheel::allocNode (void)
+{
+    if (freeList != NIL) {
+        unsigned i = freeList;
+        freeList = nodes[i].next;
+        return i;
+    }
+    nodes.push_back(Node());
+    nodes.back().generation = 1;
+    nodes.back().list = NIL;
+    return unsigned(nodes.size() - 1);
+}
+
+void TimerWheel::freeNode (unsigned i)
+{
+    Node &n = nodes[i];
+    n.cb = nullptr;
+    n.list = NIL;
+    n.generation = n.generation % MAX_GENERATION + 1;
+    n.next = freeList;
+    freeList = i;
+}
+
+void TimerWheel::link (unsigned i, unsigned list)
+{
+    Node &n = nodes[i];
+    n.list = list;
+    n.prev = NIL;
+    n.next = heads[list];
+    if (n.next != NIL) nodes[n.next].prev = i;
+    heads[list] = i;
+    if (list < FIRING) occupied[list / SLOTS][list % SLOTS / 64] |= uint64_t(1) << (list % 64);
+}
+
+void TimerWheel::unlink (unsigned i)
+{
+    Node &n = nodes[i];
+    if (n.prev == NIL) heads[n.list] = n.next;
+    else nodes[n.prev].next = n.next;
+    if (n.next != NIL) nodes[n.next].prev = n.prev;
+    if (n.list < FIRING && heads[n.list] == NIL)
+        occupied[n.list / SLOTS][n.list % SLOTS / 64] &= ~(uint64_t(1) << (n.list % 64));
+}
+
+void TimerWheel::insert (unsigned i)
+{
+    unsigned long long e = nodes[i].expiry;
+    unsigned long long d = e > current ? e - current : 0;
+    unsigned level = 0;
+    while (level < LEVELS - 1 && d >= (1ULL << (SLOT_BITS * (level + 1)))) level++;
+    if (d >> (SLOT_BITS * LEVELS)) {
+        // Out of range, park it as far ahead as possible.  It is placed
+        // again by its real expiry when that slot is cascaded.
+        e = current + (1ULL << (SLOT_BITS * LEVELS)) - 1;
+    }
+    unsigned slot = unsigned(e >> (SLOT_BITS * level)) & (SLOTS - 1);
+    link(i, level * SLOTS + slot);
+}
+
+void TimerWheel::cascade (unsigned level)
+{
+    unsigned slot = unsigned(current >> (SLOT_BITS * level)) & (SLOTS - 1);
+    unsigned list = level * SLOTS + slot;
+    unsigned i = heads[list];
+    heads[list] = NIL;
+    occupied[level][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+    while (i != NIL) {
+        unsigned next = nodes[i].next;
+        insert(i);
+        i = next;
+    }
+}
+
+size_t TimerWheel::expire (void)
+{
+    unsigned slot = unsigned(current) & (SLOTS - 1);
+    while (heads[slot] != NIL) {
+        unsigned i = heads[slot];
+        unlink(i);
+        link(i, FIRING);
+    }
+    size_t fired = 0;
+    while (heads[FIRING] != NIL) {
+        unsigned i = heads[FIRING];
+        unlink(i);
+        // The callback may grow the pool, so take it out of the node first.
+        Callback cb = std::move(nodes[i].cb);
+        firing = TimerHandle(i, nodes[i].generation);
+        freeNode(i);
+        pending--;
+        fired++;
+        cb();
+    }
+    return fired;
+}
+
+unsigned TimerWheel::nextSlot (unsigned level, unsigned from) const
+{
+    // The first occupied slot at or after from, or SLOTS if there is none.
+    for (unsigned w = from / 64 ; w < SLOTS / 64 ; ++w) {
+        uint64_t bits = occupied[level][w];
+        if (w == from / 64) bits &= ~uint64_t(0) << (from % 64);
+        if (bits == 0) continue;
+        unsigned slot = w * 64;
+        while (!(bits & 1)) {
+            bits >>= 1;
+            slot++;
+        }
+        return slot;
+    }
+    return SLOTS;
+}
+
+unsigned long long TimerWheel::nextCascade (void) const
+{
+    // The first tick after current at which an occupied slot of a later
+    // level is redistributed.  Slot s of level L is, at the ticks that are
+    // multiples of SLOTS^L and whose digit L is s.
+    unsigned long long best = ~0ULL;
+    for (unsigned level = 1 ; level < LEVELS ; ++level) {
+        unsigned shift = SLOT_BITS * level;
+        unsigned long long unit = current >> shift;
+        unsigned from = unsigned(unit + 1) & (SLOTS - 1);
+        unsigned slot = nextSlot(level, from);
+        unsigned dist;
+        if (slot != SLOTS) {
+            dist = slot - from + 1;
+        } else {
+            slot = nextSlot(level, 0);
+            if (slot == SLOTS) continue;
+            dist = slot + SLOTS - from + 1;
+        }
+        best = std::min(best, (unit + dist) << shift);
+    }
+    return best;
+}
+
+TimerHandle TimerWheel::scheduleAt (unsigned long long deadline_us, const Callback &cb)
+{
+    unsigned long long e = 0;
+    if (deadline_us > baseUs) {
+        // Rounded up, without overflowing near the top of the range.
+        unsigned long long d = deadline_us - baseUs;
+        e = d / tickUs + (d % tickUs != 0);
+    }
+    if (e <= current) e = current + 1;
+    unsigned i = allocNode();
+    nodes[i].expiry = e;
+    nodes[i].cb = cb;
+    insert(i);
+    pending++;
+    return TimerHandle(i, nodes[i].generation);
+}
+
+TimerHandle TimerWheel::schedule (unsigned long long delay_us, const Callback &cb)
+{
+    unsigned long long now = getNow();
+    // Saturate rather than wrap around into the past.
+    if (delay_us > ~0ULL - now) return scheduleAt(~0ULL, cb);
+    return scheduleAt(now + delay_us, cb);
+}
+
+bool TimerWheel::isPending (TimerHandle h) const
+{
+    return h.index < nodes.size() && nodes[h.index].generation == h.generation
+        && nodes[h.index].list != NIL;
+}
+
+bool TimerWheel::cancel (TimerHandle h)
+{
+    if (!isPending(h)) return false;
+    unlink(h.index);
+    freeNode(h.index);
+    pending--;
+    return true;
+}
+
+size_t TimerWheel::advance (unsigned long long now_us)
+{
+    if (now_us < baseUs) return 0;
+    unsigned long long target = (now_us - baseUs) / tickUs;
+    size_t fired = 0;
+    while (current < target) {
+        if (pending == 0) {
+            current = target;
+            break;
+        }
+        // Find the next occupied slot before level 0 wraps around.
+        unsigned long long wrap = (current | (SLOTS - 1)) + 1;
+        unsigned long long last = std::min(target, wrap - 1);
+        if (current < last) {
+            unsigned first = unsigned(current + 1) & (SLOTS - 1);
+            unsigned slot = nextSlot(0, first);
+            if (slot <= (unsigned(last) & (SLOTS - 1))) {
+                current += slot - first + 1;
+                fired += expire();
+                continue;
+            }
+            current = last;
+        }
+        if (current == target) break;
+        // Anything left in level 0 is due in its next revolution, so just
+        // wrap.  Otherwise go straight to the next slot of a later level
+        // that has timers, as redistributing the empty ones would do
+        // nothing.
+        unsigned long long next = wrap;
+        if (nextSlot(0, 0) == SLOTS) {
+            next = nextCascade();
+            if (next > target) {
+                current = target;
+                break;
+            }
+        }
+        current = next;
+        for (unsigned level = 1 ; level < LEVELS ; ++level) {
+            cascade(level);
+            if ((current >> (SLOT_BITS * level)) & (SLOTS - 1)) break;
+        }
+        fired += expire();
+    }
+    return fired;
+}
+
+
+// Lua binding.  Callbacks are kept in the userdata's environment table,
+// keyed by handle, so that they are reachable by the GC.
+
+#define TIMER_WHEEL_TAG "Grit/TimerWheel"
+
+namespace {
+
+    struct LuaTimerWheel {
+        TimerWheel wheel;
+        lua_State *L;       // during advance, with the userdata at index 1
+
+        LuaTimerWheel (unsigned long long tick_us, unsigned long long now_us)
+          : wheel(tick_us, now_us), L(NULL)
+        { }
+
+        void fire (lua_Number key)
+        {
+            STACK_BASE;
+            lua_pushcfunction(L, my_lua_error_handler_cerr);
+            lua_getfenv(L, 1);
+            lua_pushnumber(L, key);
+            lua_rawget(L, -2);
+            lua_pushnumber(L, key);
+            lua_pushnil(L);
+            lua_rawset(L, -4);
+            // error handler, env, func
+            lua_remove(L, -2);
+            if (lua_pcall(L, 0, 0, -2)) lua_pop(L, 1);
+            lua_pop(L, 1);
+            STACK_CHECK;
+        }
+    };
+
+    // Exact in a double, since generations fit in 20 bits.
+    lua_Number handle_key (TimerHandle h)
+    {
+        return lua_Number(h.generation) * 4294967296.0 + h.index;
+    }
+
+    // Casting a double that does not fit to an integer is undefined, so check
+    // first.  A double is not exact beyond 2^53 anyway (285 years of us).
+    unsigned long long check_micros (lua_State *L, int idx, const char *what)
+    {
+        lua_Number v = luaL_checknumber(L, idx);
+        if (!std::isfinite(v)) my_lua_error(L, std::string(what) + " must be a finite number");
+        if (v < 0) return 0;
+        if (v > 9007199254740992.0) v = 9007199254740992.0;
+        return (unsigned long long)v;
+    }
+
+    TimerHandle key_handle (lua_Number key)
+    {
+        if (!(key >= 0 && key < 9007199254740992.0)) return TimerHandle();
+        unsigned long long k = (unsigned long long)key;
+        return TimerHandle(unsigned(k & 0xffffffff), unsigned(k >> 32));
+    }
+
+}
+
+static int timer_wheel_schedule_aux (lua_State *L, bool absolute)
+{
+    check_args(L, 3);
+    GET_UD_MACRO(LuaTimerWheel, self, 1, TIMER_WHEEL_TAG);
+    unsigned long long when = check_micros(L, 2, absolute ? "Deadline" : "Delay");
+    check_is_function(L, 3);
+    LuaTimerWheel *ptr = &self;
+    TimerWheel::Callback cb = [ptr] () { ptr->fire(handle_key(ptr->wheel.getFiring())); };
+    TimerHandle h = absolute ? self.wheel.scheduleAt(when, cb) : self.wheel.schedule(when, cb);
+    lua_Number key = handle_key(h);
+    lua_getfenv(L, 1);
+    lua_pushnumber(L, key);
+    lua_pushvalue(L, 3);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    lua_pushnumber(L, key);
+    return 1;
+}
+
+static int timer_wheel_schedule (lua_State *L)
+{
+    return timer_wheel_schedule_aux(L, false);
+}
+
+static int timer_wheel_schedule_at (lua_State *L)
+{
+    return timer_wheel_schedule_aux(L, true);
+}
+
+static int timer_wheel_cancel (lua_State *L)
+{
+    check_args(L, 2);
+    GET_UD_MACRO(LuaTimerWheel, self, 1, TIMER_WHEEL_TAG);
+    lua_Number key = luaL_checknumber(L, 2);
+    if (!self.wheel.cancel(key_handle(key))) {
+        lua_pushboolean(L, false);
+        return 1;
+    }
+    lua_getfenv(L, 1);
+    lua_pushnumber(L, key);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+static int timer_wheel_advance (lua_State *L)
+{
+    check_args(L, 2);
+    GET_UD_MACRO(LuaTimerWheel, self, 1, TIMER_WHEEL_TAG);
+    unsigned long long now = check_micros(L, 2, "Time");
+    if (self.L != NULL) my_lua_error(L, "TimerWheel:advance() called from a timer callback");
+    self.L = L;
+    size_t fired = self.wheel.advance(now);
+    self.L = NULL;
+    lua_pushnumber(L, fired);
+    return 1;
+}
+
+TOSTRING_ADDR_MACRO(timer_wheel, LuaTimerWheel, TIMER_WHEEL_TAG)
+
+GC_MACRO(LuaTimerWheel, timer_wheel, TIMER_WHEEL_TAG)
+
+static int timer_wheel_index (lua_State *L)
+{
+    check_args(L, 2);
+    GET_UD_MACRO(LuaTimerWheel, self, 1, TIMER_WHEEL_TAG);
+    std::string key = check_string(L, 2);
+    if (key == "schedule") {
+        push_cfunction(L, timer_wheel_schedule);
+    } else if (key == "scheduleAt") {
+        push_cfunction(L, timer_wheel_schedule_at);
+    } else if (key == "cancel") {
+        push_cfunction(L, timer_wheel_cancel);
+    } else if (key == "advance") {
+        push_cfunction(L, timer_wheel_advance);
+    } else if (key == "pending") {
+        lua_pushnumber(L, self.wheel.getPending());
+    } else if (key == "tick") {
+        lua_pushnumber(L, self.wheel.getTick());
+    } else if (key == "now") {
+        lua_pushnumber(L, self.wheel.getNow());
+    } else {
+        my_lua_error(L, "Not a readable TimerWheel member: " + key);
+    }
+    return 1;
+}
+
+EQ_PTR_MACRO(LuaTimerWheel, timer_wheel, TIMER_WHEEL_TAG)
+
+MT_MACRO(timer_wheel);
+
+static int global_timer_wheel (lua_State *L)
+{
+    check_args(L, 2);
+    unsigned long long tick = check_micros(L, 1, "TimerWheel tick");
+    unsigned long long now = check_micros(L, 2, "Time");
+    if (tick < 1) my_lua_error(L, "TimerWheel tick must be at least 1us");
+    push(L, new LuaTimerWheel(tick, now), TIMER_WHEEL_TAG);
+    lua_newtable(L);
+    lua_setfenv(L, -2);
+    return 1;
+}
+
+static const luaL_reg timer_wheel_globals[] = {
+    {"TimerWheel", global_timer_wheel},
+    {NULL, NULL}
+};
+
+void timer_wheel_lua_init (lua_State *L)
+{
+    luaL_newmetatable(L, TIMER_WHEEL_TAG);
+    luaL_register(L, NULL, timer_wheel_meta_table);
+    lua_pop(L, 1);
+    register_lua_globals(L, timer_wheel_globals);
+}
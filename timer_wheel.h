@@ -0,0 +1,152 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstdint>
+
+#include <functional>
+#include <vector>
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+/** Identifies a scheduled timer.  Stays safe to use after the timer has
+ * fired or been cancelled, because its node's generation will have changed.
+ * Generations wrap after 2^20 reuses of a node, so that a handle fits
+ * exactly in a Lua number. */
+struct TimerHandle {
+    unsigned index;
+    unsigned generation;    // 0 is never valid
+    TimerHandle (void) : index(0), generation(0) { }
+    TimerHandle (unsigned index, unsigned generation) : index(index), generation(generation) { }
+};
+
+/** Many timeouts, e.g. one per entity or connection, with constant time
+ * schedule and cancel.
+ *
+ * Time is divided into ticks.  Timers are kept in 4 levels of 256 slots: the
+ * first level has one slot per tick for the next 256 ticks, each later level
+ * covers 256 times the span of the previous one.  As time passes, slots of
+ * the later levels are redistributed into the earlier ones, so each timer
+ * moves at most 3 times.  Deadlines more than 2^32 ticks away are kept in
+ * the last level until they come within range.
+ *
+ * Timers fire from advance(), at the first tick at or after their deadline,
+ * in tick order.  Callbacks may schedule and cancel timers, including ones
+ * due in the same advance().  Nodes are pooled and reused, so a steady state
+ * does not allocate (except for callbacks too big for std::function to hold
+ * inline).
+ */
+class TimerWheel {
+
+    public:
+
+    typedef std::function<void (void)> Callback;
+
+    /** \param tick_us The resolution, e.g. 1000 for 1ms.
+     * \param now_us The current time, on the clock later given to advance(). */
+    TimerWheel (unsigned long long tick_us, unsigned long long now_us);
+
+    TimerWheel (const TimerWheel &) = delete;
+    TimerWheel &operator= (const TimerWheel &) = delete;
+
+    /** Call cb once delay_us has passed, counting from getNow(). */
+    TimerHandle schedule (unsigned long long delay_us, const Callback &cb);
+
+    /** Call cb at the given time, or on the next tick if it has passed. */
+    TimerHandle scheduleAt (unsigned long long deadline_us, const Callback &cb);
+
+    /** Returns false if the timer had already fired or been cancelled. */
+    bool cancel (TimerHandle h);
+
+    bool isPending (TimerHandle h) const;
+
+    /** Fire everything due up to now_us.  Empty stretches of time are
+     * skipped, not stepped through tick by tick or slot by slot, so a jump
+     * costs time in proportion to the timers due or moved between levels.
+     * Returns the number fired. */
+    size_t advance (unsigned long long now_us);
+
+    /** Timers scheduled and not yet fired or cancelled. */
+    size_t getPending (void) const { return pending; }
+
+    /** Inside a callback, the handle of the timer that is firing. */
+    TimerHandle getFiring (void) const { return firing; }
+
+    unsigned long long getTick (void) const { return tickUs; }
+
+    /** The time that advance() has reached, rounded down to a tick. */
+    unsigned long long getNow (void) const { return baseUs + current * tickUs; }
+
+    private:
+
+    static const unsigned LEVELS = 4;
+    static const unsigned SLOT_BITS = 8;
+    static const unsigned SLOTS = 1 << SLOT_BITS;
+    static const unsigned NIL = ~0u;
+    static const unsigned MAX_GENERATION = 1 << 20;
+    // A list that is not a slot, for timers being fired.
+    static const unsigned FIRING = LEVELS * SLOTS;
+
+    struct Node {
+        unsigned long long expiry;  // in ticks
+        Callback cb;
+        unsigned next, prev;
+        unsigned list;              // level * SLOTS + slot, FIRING, or NIL if free
+        unsigned generation;
+    };
+
+    unsigned long long tickUs;
+    unsigned long long baseUs;
+    unsigned long long current;     // ticks since baseUs
+
+    std::vector<Node> nodes;
+    unsigned freeList;
+    size_t pending;
+    TimerHandle firing;
+
+    unsigned heads[LEVELS * SLOTS + 1];
+    // Occupied slots of each level, to skip empty stretches quickly.
+    uint64_t occupied[LEVELS][SLOTS / 64];
+
+    unsigned allocNode (void);
+    void freeNode (unsigned i);
+    void link (unsigned i, unsigned list);
+    void unlink (unsigned i);
+    void insert (unsigned i);
+    void cascade (unsigned level);
+    size_t expire (void);
+    unsigned nextSlot (unsigned level, unsigned from) const;
+    unsigned long long nextCascade (void) const;
+};
+
+/** Add the TimerWheel(tick_us, now_us) constructor to the globals.  The
+ * object has methods schedule(delay_us, func), scheduleAt(deadline_us,
+ * func), cancel(handle), advance(now_us), and a pending field.  Handles are
+ * numbers.  Errors in callbacks are reported and do not stop the others. */
+void timer_wheel_lua_init (lua_State *L);
+
+#endif
@@ -0,0 +1,39 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "file_watcher.h"
+#include "exception.h"
+
+// Not implemented yet (it would use ReadDirectoryChangesW), so refuse to
+// construct a watcher rather than return one that never reports anything.
+
+void FileWatcher::osOpen (void)
+{
+        EXCEPT << "File watching is not supported on Windows" << ENDL;
+}
+
+// Unreachable, as no FileWatcher can be constructed.
+void FileWatcher::osClose (void) { }
+void FileWatcher::osAddWatch (const std::string &, const std::string &) { }
+void FileWatcher::osRead (std::vector<RawEvent> &) { }
+bool FileWatcher::osWait (unsigned long long) { return false; }
+
+// vim: shiftwidth=8:tabstop=8:expandtab
@@ -0,0 +1,128 @@
+/* Copyright (c) David Cunningham and the Grit Game Engine project 2015
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <sstream>
+
+#include <windows.h>
+
+#include "io_util.h"
+
+MappedFile::MappedFile (const std::string &filename, bool populate)
+  : base(NULL), len(0), filename(filename)
+{
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+                EXCEPT<<filename<<": Could not open file (error "<<GetLastError()<<")"<<ENDL;
+        }
+        LARGE_INTEGER sz;
+        if (!GetFileSizeEx(file, &sz)) {
+                DWORD err = GetLastError();
+                CloseHandle(file);
+                EXCEPT<<filename<<": Could not get file size (error "<<err<<")"<<ENDL;
+        }
+        len = size_t(sz.QuadPart);
+        // Mapping an empty file fails, it just has no data.
+        if (len == 0) {
+                CloseHandle(file);
+                return;
+        }
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        DWORD err = GetLastError();
+        CloseHandle(file);
+        if (mapping == NULL) {
+                EXCEPT<<filename<<": Could not map file (error "<<err<<")"<<ENDL;
+        }
+        void *p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        err = GetLastError();
+        // The view keeps the mapping alive.
+        CloseHandle(mapping);
+        if (p == NULL) {
+                EXCEPT<<filename<<": Could not map file (error "<<err<<")"<<ENDL;
+        }
+        base = static_cast<const char*>(p);
+        if (populate) advise(ADVISE_WILLNEED);
+}
+
+MappedFile::~MappedFile (void)
+{
+        if (base != NULL) UnmapViewOfFile(base);
+}
+
+void MappedFile::advise (Advice advice, size_t offset, size_t sz)
+{
+        // Windows has no equivalent of the sequential and random hints.
+        if (advice != ADVISE_WILLNEED) return;
+        if (base == NULL || offset >= len) return;
+        if (sz > len - offset) sz = len - offset;
+        // Touch a byte of each page to fault it in.
+        volatile char sink = 0;
+        for (size_t i=offset ; i<offset+sz ; i+=4096) sink += base[i];
+        (void) sink;
+}
+
+static std::string last_error (void)
+{
+        std::stringstream ss;
+        ss << "Windows error " << GetLastError();
+        return ss.str();
+}
+
+void BufferedOutFile::osOpen (void)
+{
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_WRITE, 0, NULL,
+                                  CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+                EXCEPT<<filename<<": Could not open file (error "<<GetLastError()<<")"<<ENDL;
+        }
+        handle = (long long)file;
+}
+
+void BufferedOutFile::osClose (void)
+{
+        if (!CloseHandle((HANDLE)handle)) setError(last_error());
+}
+
+std::string BufferedOutFile::osWrite (const Span<const char> *bufs, size_t n)
+{
+        // There is no gathered write for ordinary files, so one call each.
+        for (size_t i=0 ; i<n ; ++i) {
+                const char *p = bufs[i].data();
+                size_t left = bufs[i].size();
+                while (left > 0) {
+                        DWORD chunk = DWORD(std::min(left, size_t(1) << 30));
+                        DWORD written;
+                        if (!WriteFile((HANDLE)handle, p, chunk, &written, NULL))
+                                return last_error();
+                        p += written;
+                        left -= written;
+                }
+        }
+        return "";
+}
+
+std::string BufferedOutFile::osSync (void)
+{
+        if (!FlushFileBuffers((HANDLE)handle)) return last_error();
+        return "";
+}
+
+// vim: shiftwidth=8:tabstop=8:expandtab
@@ -21,6 +21,8 @@
 
 #include <windows.h>
 
+#include "sleep.h"
+
 void mysleep (long micros)
 {
         if (micros<=0) return;
@@ -28,6 +30,26 @@ void mysleep (long micros)
         Sleep(millis);
 }
 
+void mysleep_until (unsigned long long deadline_ns)
+{
+        unsigned long long now = clock_nanos();
+        if (now >= deadline_ns) return;
+        // Sleep has millisecond granularity, so round down and leave the rest
+        // to the caller.
+        Sleep(DWORD((deadline_ns - now) / 1000000ULL));
+}
+
+unsigned long long clock_nanos (void)
+{
+        static LARGE_INTEGER freq = { };
+        if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+        LARGE_INTEGER c;
+        QueryPerformanceCounter(&c);
+        unsigned long long ticks = c.QuadPart, f = freq.QuadPart;
+        // Split to avoid overflowing ticks * 1e9.
+        return ticks / f * 1000000000ULL + ticks % f * 1000000000ULL / f;
+}
+
 unsigned long long micros (void)
 {
         static bool initialised = false;